@@ -4,12 +4,19 @@
 #include <cstring>
 #include <iostream>
 
+#include "MatrixTrace.h"
+
 using namespace std;
 using namespace std::chrono;
 
-MatrixAudioPlayer::MatrixAudioPlayer() {
+MatrixAudioPlayer::MatrixAudioPlayer(MatrixReactor* reactor) {
   // initialize inside
   state = EMPTY;
+  if (!reactor) {
+    ownReactor = make_unique<MatrixReactor>();
+    reactor = ownReactor.get();
+  }
+  this->reactor = reactor;
 
   // initialize FMOD
   FMOD_RESULT result;
@@ -36,33 +43,11 @@ MatrixAudioPlayer::MatrixAudioPlayer() {
     system = nullptr;
     return;
   }
-
-  // start polling thread
-  runPollThread = true;
-  trackEndedPollThread = thread([this] {
-    while (runPollThread) {
-      mtx.lock();
-      bool isChannelPlaying = true;
-      if (state == PLAYING) {
-        FMOD_RESULT result = channel->isPlaying(&isChannelPlaying);
-        if (!isChannelPlaying) {
-          state = STOPPED;
-          notifyListenersTrackEnded();
-        }
-      }
-      mtx.unlock();
-      this_thread::sleep_for(milliseconds(50));
-    }
-  });
 }
 
 MatrixAudioPlayer::~MatrixAudioPlayer() {
-  runPollThread = false;
-  if (trackEndedPollThread.joinable()) {
-    trackEndedPollThread.join();
-  }
-
   clear();
+  discardStaged();
   if (sound != nullptr) {
     sound->release();
     sound = nullptr;
@@ -73,34 +58,54 @@ MatrixAudioPlayer::~MatrixAudioPlayer() {
   }
 }
 
-void MatrixAudioPlayer::play() {
+void MatrixAudioPlayer::play() { playAt(clock->now()); }
+
+void MatrixAudioPlayer::playAt(MatrixClock::time_point start) {
   std::lock_guard<std::mutex> lk(mtx);
 
   if (state == STOPPED) {
     system->playSound(sound, 0, true, &channel);
     channel->setVolume(volume);
-    channel->setPaused(false);
-    state = PLAYING;
-  } else if (state == PAUSED) {
-    channel->setPaused(false);
-    state = PLAYING;
+  } else if (state != PAUSED) {
+    return;
   }
+  // holds the channel silent until the mixer reaches start, a start in the
+  // past or an unknown DSP clock plays right away
+  channel->setDelay(dspClockAt(start), 0, false);
+  channel->setPaused(false);
+  // hand the commands to the mixer now, not at the next service
+  system->update();
+  state = PLAYING;
+  startService();
 }
 
 void MatrixAudioPlayer::pause() {
-  std::lock_guard<std::mutex> lk(mtx);
+  {
+    std::lock_guard<std::mutex> lk(mtx);
 
-  if (state == PLAYING) {
-    channel->setPaused(true);
-    state = PAUSED;
+    if (state == PLAYING) {
+      channel->setPaused(true);
+      state = PAUSED;
+    }
   }
+  stopService();
 }
 
 void MatrixAudioPlayer::stop() {
-  std::lock_guard<std::mutex> lk(mtx);
-  if (state == PLAYING || state == PAUSED) {
-    channel->stop();
-    state = STOPPED;
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (state == PLAYING || state == PAUSED) {
+      channel->stop();
+      state = STOPPED;
+    }
+  }
+  stopService();
+}
+
+void MatrixAudioPlayer::setClock(MatrixClock* clock) {
+  this->clock = clock;
+  if (ownReactor) {
+    ownReactor->setClock(clock);
   }
 }
 
@@ -160,36 +165,121 @@ void MatrixAudioPlayer::notifyListenersTrackEnded() {
   }
 }
 
+void MatrixAudioPlayer::service() {
+  std::lock_guard<std::mutex> lk(mtx);
+  if (state == PLAYING) {
+    bool isChannelPlaying = true;
+    channel->isPlaying(&isChannelPlaying);
+    if (!isChannelPlaying) {
+      state = STOPPED;
+      reactor->cancel(serviceTimer);  // on the reactor, does not wait
+      serviceTimer = 0;
+      notifyListenersTrackEnded();
+    }
+  }
+  system->update();
+}
+
+void MatrixAudioPlayer::startService() {
+  // called with mtx held
+  if (serviceTimer == 0 && system) {
+    serviceTimer =
+        reactor->schedulePeriodic(milliseconds(50), [this] { service(); });
+  }
+}
+
+unsigned long long MatrixAudioPlayer::dspClockAt(
+    MatrixClock::time_point time) const {
+  // called with mtx held
+  FMOD::ChannelGroup* master = nullptr;
+  unsigned long long dspClock = 0;
+  int sampleRate = 0;
+  if (system->getMasterChannelGroup(&master) != FMOD_OK ||
+      master->getDSPClock(&dspClock, nullptr) != FMOD_OK ||
+      system->getSoftwareFormat(&sampleRate, nullptr, nullptr) != FMOD_OK ||
+      sampleRate <= 0) {
+    return 0;
+  }
+
+  // the DSP clock counts output samples but only moves a mix block at a
+  // time, the start may be up to one block late
+  auto ahead = duration_cast<microseconds>(time - clock->now());
+  if (ahead <= microseconds(0)) {
+    return 0;
+  }
+  return dspClock + ahead.count() * (unsigned long long)sampleRate / 1000000;
+}
+
+void MatrixAudioPlayer::stopService() {
+  MatrixReactor::TimerId timer;
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (state == PLAYING) {
+      return;  // played again meanwhile
+    }
+    timer = serviceTimer;
+    serviceTimer = 0;
+  }
+  // outside the lock, a running service() needs it to finish
+  reactor->cancel(timer);
+}
+
 // --- Input data --- //
 bool MatrixAudioPlayer::load(const void* data, size_t size) {
-  stop();
-  std::lock_guard<std::mutex> lk(mtx);
+  return stage(data, size) && commit();
+}
+
+bool MatrixAudioPlayer::stage(const void* data, size_t size) {
+  MATRIX_TRACE_SCOPE("load", "MatrixAudioPlayer::stage");
+  discardStaged();
 
   // make a copy of input data
-  state = EMPTY;
-  this->data.reset(operator new(size));
-  this->size = size;
-  memcpy(this->data.get(), data, size);
+  stagedData.reset(operator new(size));
+  stagedSize = size;
+  memcpy(stagedData.get(), data, size);
 
-  // create an fmod sound
+  // create an fmod sound, FMOD decodes it in full right here
   if (!system) {
     return false;
   }
   FMOD_CREATESOUNDEXINFO soundInfo;
   memset(&soundInfo, 0, sizeof(soundInfo));
   soundInfo.cbsize = sizeof(soundInfo);
-  soundInfo.length = this->size;
-  FMOD_RESULT result =
-      system->createSound(reinterpret_cast<const char*>(this->data.get()),
-                          FMOD_OPENMEMORY | FMOD_LOOP_OFF, &soundInfo, &sound);
+  soundInfo.length = stagedSize;
+  FMOD_RESULT result = system->createSound(
+      reinterpret_cast<const char*>(stagedData.get()),
+      FMOD_OPENMEMORY | FMOD_LOOP_OFF, &soundInfo, &stagedSound);
   if (result != FMOD_OK) {
+    stagedSound = nullptr;
     return false;
   }
-
-  state = STOPPED;
   return true;
 }
 
+bool MatrixAudioPlayer::commit() {
+  stop();
+  std::lock_guard<std::mutex> lk(mtx);
+
+  if (sound != nullptr) {
+    sound->release();
+  }
+  sound = stagedSound;
+  stagedSound = nullptr;
+  data = std::move(stagedData);
+  size = stagedSize;
+  state = sound != nullptr ? STOPPED : EMPTY;
+  return sound != nullptr;
+}
+
+void MatrixAudioPlayer::discardStaged() {
+  if (stagedSound != nullptr) {
+    stagedSound->release();
+    stagedSound = nullptr;
+  }
+  stagedData.reset();
+  stagedSize = 0;
+}
+
 void MatrixAudioPlayer::clear() {
   stop();
 
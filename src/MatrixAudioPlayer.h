@@ -6,7 +6,9 @@
 #include <memory>
 #include <mutex>
 #include <set>
-#include <thread>
+
+#include "MatrixClock.h"
+#include "MatrixReactor.h"
 
 class MatrixAudioPlayerListener;
 
@@ -20,10 +22,17 @@ class MatrixAudioPlayer {
   };
 
  public:
-  MatrixAudioPlayer();
+  /// FMOD is serviced on reactor while playing, which must outlive the
+  /// player. Without one the player runs a reactor of its own.
+  explicit MatrixAudioPlayer(MatrixReactor* reactor = nullptr);
   ~MatrixAudioPlayer();
 
   void play();
+  /// Start or resume with the first sample at start, a clock time that may
+  /// lie slightly in the future. The start is scheduled on the DSP clock of
+  /// the mixer, so it lands on the sample no matter when the mixer thread
+  /// picks the command up.
+  void playAt(MatrixClock::time_point start);
   void pause();
   void stop();
 
@@ -42,17 +51,35 @@ class MatrixAudioPlayer {
   void addListener(MatrixAudioPlayerListener*);
   void removeListener(MatrixAudioPlayerListener*);
 
+  /// Time source of the track end polling. A reactor passed in from outside
+  /// keeps the clock it was given.
+  void setClock(MatrixClock* clock);
+
   // --- Input data --- //
   bool load(const void* data, size_t size);
+  /// load() in two steps: stage() copies and opens the sound while the
+  /// current one plays on, commit() switches over to it. One thread stages
+  /// at a time.
+  bool stage(const void* data, size_t size);
+  bool commit();
+  void discardStaged();
   void clear();
 
  private:
   // administration stuff
   std::set<MatrixAudioPlayerListener*> listeners;
   void notifyListenersTrackEnded();
-  std::thread trackEndedPollThread;
+  // polls for the end of the track and lets FMOD do its housekeeping
+  void service();
+  void startService();
+  void stopService();
+  // DSP clock of the master channel group at clock time, 0 if unknown
+  unsigned long long dspClockAt(MatrixClock::time_point time) const;
   mutable std::mutex mtx;
-  std::atomic_bool runPollThread;
+  MatrixClock* clock = &MatrixClock::system();
+  std::unique_ptr<MatrixReactor> ownReactor;
+  MatrixReactor* reactor;
+  MatrixReactor::TimerId serviceTimer = 0;
 
   // sound stuff
   struct Deleter {
@@ -62,6 +89,10 @@ class MatrixAudioPlayer {
   std::unique_ptr<void, Deleter> data;
   size_t size;
   std::atomic<eState> state;
+  // the next sound, until commit()
+  std::unique_ptr<void, Deleter> stagedData;
+  size_t stagedSize = 0;
+  FMOD::Sound* stagedSound = nullptr;
 
   float volume = 1.0f;
 
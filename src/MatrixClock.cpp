@@ -0,0 +1,212 @@
+#include "MatrixClock.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+MatrixClock& MatrixClock::system() {
+  static MatrixSystemClock clock;
+  return clock;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// System clock
+
+auto MatrixSystemClock::now() const -> time_point {
+  return steady_clock::now();
+}
+
+void MatrixSystemClock::sleepUntil(time_point deadline) {
+  this_thread::sleep_until(deadline);
+}
+
+bool MatrixSystemClock::waitUntil(std::condition_variable& cv,
+                                  std::unique_lock<std::mutex>& lock,
+                                  time_point deadline,
+                                  const std::function<bool()>& pred) {
+  // wait_until would overflow converting "forever" to the system clock
+  if (deadline == time_point::max()) {
+    cv.wait(lock, pred);
+    return true;
+  }
+  return cv.wait_until(lock, deadline, pred);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Simulated clock
+
+MatrixSimulatedClock::MatrixSimulatedClock(time_point start) {
+  currentTime = start;
+  autoAdvanceThreads = 0;
+}
+
+auto MatrixSimulatedClock::now() const -> time_point {
+  lock_guard<mutex> lk(clockMutex);
+  return currentTime;
+}
+
+void MatrixSimulatedClock::sleepUntil(time_point deadline) {
+  unique_lock<mutex> lk(sleepMutex);
+  waitUntil(sleepCv, lk, deadline, [] { return false; });
+}
+
+bool MatrixSimulatedClock::waitUntil(std::condition_variable& cv,
+                                     std::unique_lock<std::mutex>& lock,
+                                     time_point deadline,
+                                     const std::function<bool()>& pred) {
+  Waiter waiter = {deadline, &cv, lock.mutex()};
+  {
+    lock_guard<mutex> lk(clockMutex);
+    waiters.push_back(&waiter);
+  }
+  waiterCountChanged.notify_all();
+
+  while (!pred() && now() < deadline) {
+    tryAutoAdvance(lock.mutex());
+    if (pred() || now() >= deadline) {
+      break;
+    }
+    // the short real timeout only matters if a notification raced with us
+    cv.wait_for(lock, milliseconds(1));
+  }
+
+  {
+    lock_guard<mutex> lk(clockMutex);
+    waiters.erase(find(waiters.begin(), waiters.end(), &waiter));
+  }
+  waiterCountChanged.notify_all();
+  return pred();
+}
+
+void MatrixSimulatedClock::set(time_point time) {
+  {
+    lock_guard<mutex> lk(clockMutex);
+    currentTime = max(currentTime, time);
+  }
+  notifyWaiters(nullptr);
+}
+
+void MatrixSimulatedClock::setAutoAdvance(size_t numThreads) {
+  {
+    lock_guard<mutex> lk(clockMutex);
+    autoAdvanceThreads = numThreads;
+  }
+  notifyWaiters(nullptr);
+}
+
+void MatrixSimulatedClock::waitForWaiters(size_t numThreads) {
+  unique_lock<mutex> lk(clockMutex);
+  waiterCountChanged.wait(lk,
+                          [&] { return waiters.size() >= numThreads; });
+}
+
+size_t MatrixSimulatedClock::getWaiterCount() const {
+  lock_guard<mutex> lk(clockMutex);
+  return waiters.size();
+}
+
+void MatrixSimulatedClock::tryAutoAdvance(std::mutex* heldMutex) {
+  {
+    lock_guard<mutex> lk(clockMutex);
+    if (autoAdvanceThreads == 0 || waiters.size() < autoAdvanceThreads) {
+      return;
+    }
+    time_point earliest = time_point::max();
+    for (auto waiter : waiters) {
+      earliest = min(earliest, waiter->deadline);
+    }
+    // somebody is due already, or everybody waits forever
+    if (earliest <= currentTime || earliest == time_point::max()) {
+      return;
+    }
+    currentTime = earliest;
+  }
+  notifyWaiters(heldMutex);
+}
+
+void MatrixSimulatedClock::notifyWaiters(std::mutex* heldMutex) {
+  vector<Waiter> pending;
+  {
+    lock_guard<mutex> lk(clockMutex);
+    for (auto waiter : waiters) {
+      pending.push_back(*waiter);
+    }
+  }
+
+  // Notify under the waiter's mutex when possible so the wakeup cannot slip
+  // in between its time check and its wait. Blocking on the mutex could
+  // deadlock against another waker, the waiter's short timeout covers that.
+  for (auto& waiter : pending) {
+    if (waiter.mtx == heldMutex) {
+      waiter.cv->notify_all();
+    } else if (waiter.mtx->try_lock()) {
+      waiter.cv->notify_all();
+      waiter.mtx->unlock();
+    } else {
+      waiter.cv->notify_all();
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Disciplined clock
+
+MatrixDisciplinedClock::MatrixDisciplinedClock(MatrixClock& base)
+    : base(base) {
+  Discipline initial;
+  initial.anchor = base.now();
+  discipline.store(initial);
+}
+
+auto MatrixDisciplinedClock::now() const -> time_point {
+  time_point baseTime = base.now();
+  return baseTime + offsetAt(discipline.load(), baseTime);
+}
+
+void MatrixDisciplinedClock::sleepUntil(time_point deadline) {
+  base.sleepUntil(toBase(deadline));
+}
+
+bool MatrixDisciplinedClock::waitUntil(std::condition_variable& cv,
+                                       std::unique_lock<std::mutex>& lock,
+                                       time_point deadline,
+                                       const std::function<bool()>& pred) {
+  // the offset moves by at most MaxSlewRate of the wait meanwhile
+  return base.waitUntil(cv, lock, toBase(deadline), pred);
+}
+
+void MatrixDisciplinedClock::setTargetOffset(duration offset,
+                                             bool isStepping) {
+  time_point baseTime = base.now();
+  Discipline next;
+  next.anchor = baseTime;
+  next.offset = offsetAt(discipline.load(), baseTime);
+  next.target = offset;
+  auto error = offset - next.offset;
+  if (isStepping || error > StepThreshold || error < -StepThreshold) {
+    next.offset = offset;
+  }
+  discipline.store(next);
+}
+
+auto MatrixDisciplinedClock::getOffset() const -> duration {
+  return offsetAt(discipline.load(), base.now());
+}
+
+auto MatrixDisciplinedClock::offsetAt(const Discipline& current,
+                                      time_point baseTime) const -> duration {
+  auto maxSlew = duration_cast<duration>((baseTime - current.anchor) *
+                                         MaxSlewRate);
+  auto error = current.target - current.offset;
+  return current.offset + clamp(error, -maxSlew, maxSlew);
+}
+
+auto MatrixDisciplinedClock::toBase(time_point deadline) const
+    -> time_point {
+  if (deadline == time_point::max()) {
+    return deadline;
+  }
+  return deadline - getOffset();
+}
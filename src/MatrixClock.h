@@ -0,0 +1,154 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "MatrixSeqlock.h"
+
+/// Time source and waiting primitive of the playback threads.
+///
+/// Every scheduling decision in the players goes through a clock, so tests
+/// can swap the wall clock for a MatrixSimulatedClock and run hours of
+/// playback in milliseconds.
+class MatrixClock {
+ public:
+  using duration = std::chrono::steady_clock::duration;
+  using time_point = std::chrono::steady_clock::time_point;
+
+  virtual ~MatrixClock() = default;
+
+  virtual time_point now() const = 0;
+
+  /// Block until deadline has passed.
+  virtual void sleepUntil(time_point deadline) = 0;
+
+  /// Wait on cv until pred holds or deadline has passed, lock must hold the
+  /// mutex cv is used with. Returns the final value of pred.
+  virtual bool waitUntil(std::condition_variable& cv,
+                         std::unique_lock<std::mutex>& lock,
+                         time_point deadline,
+                         const std::function<bool()>& pred) = 0;
+
+  template <class Rep, class Period>
+  void sleepFor(std::chrono::duration<Rep, Period> time) {
+    sleepUntil(now() + std::chrono::duration_cast<duration>(time));
+  }
+
+  template <class Rep, class Period>
+  bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock,
+               std::chrono::duration<Rep, Period> time,
+               const std::function<bool()>& pred) {
+    return waitUntil(cv, lock,
+                     now() + std::chrono::duration_cast<duration>(time), pred);
+  }
+
+  /// The process wide steady wall clock, used unless another one is set.
+  static MatrixClock& system();
+};
+
+/// Wall clock backed by std::chrono::steady_clock.
+class MatrixSystemClock : public MatrixClock {
+ public:
+  time_point now() const override;
+  void sleepUntil(time_point deadline) override;
+  bool waitUntil(std::condition_variable& cv,
+                 std::unique_lock<std::mutex>& lock, time_point deadline,
+                 const std::function<bool()>& pred) override;
+};
+
+/// Virtual clock for deterministic tests.
+///
+/// Time only moves through advance()/set(), or automatically: with
+/// setAutoAdvance(n), as soon as n threads are blocked in the clock, virtual
+/// time jumps straight to the earliest of their deadlines. Waits therefore
+/// cost no wall time, yet every thread observes the same ordering of events
+/// as it would in real time.
+class MatrixSimulatedClock : public MatrixClock {
+ public:
+  MatrixSimulatedClock(time_point start = time_point());
+
+  time_point now() const override;
+  void sleepUntil(time_point deadline) override;
+  bool waitUntil(std::condition_variable& cv,
+                 std::unique_lock<std::mutex>& lock, time_point deadline,
+                 const std::function<bool()>& pred) override;
+
+  template <class Rep, class Period>
+  void advance(std::chrono::duration<Rep, Period> time) {
+    set(now() + std::chrono::duration_cast<duration>(time));
+  }
+  void set(time_point time);
+
+  /// Advance automatically once numThreads threads wait, 0 turns it off.
+  void setAutoAdvance(size_t numThreads);
+
+  /// Block the calling (real) thread until at least numThreads threads are
+  /// waiting inside the clock, i.e. the simulation has settled.
+  void waitForWaiters(size_t numThreads);
+  size_t getWaiterCount() const;
+
+ private:
+  struct Waiter {
+    time_point deadline;
+    std::condition_variable* cv;
+    std::mutex* mtx;
+  };
+
+  void notifyWaiters(std::mutex* heldMutex);
+  void tryAutoAdvance(std::mutex* heldMutex);
+
+  mutable std::mutex clockMutex;
+  std::condition_variable waiterCountChanged;
+  time_point currentTime;
+  size_t autoAdvanceThreads;
+  std::vector<Waiter*> waiters;
+
+  // sleepUntil has no condition of its own
+  std::mutex sleepMutex;
+  std::condition_variable sleepCv;
+};
+
+/// Another clock shifted by an offset that is steered towards a target,
+/// e.g. the clock of a remote machine as estimated over the network.
+///
+/// Small corrections are slewed at MaxSlewRate, so time never jumps and
+/// never runs backwards while frames are scheduled on it. Errors beyond
+/// StepThreshold are stepped, there is no point in slewing for minutes.
+class MatrixDisciplinedClock : public MatrixClock {
+ public:
+  static constexpr double MaxSlewRate = 0.0005;  // 500 us per second
+  static constexpr std::chrono::milliseconds StepThreshold{20};
+
+  explicit MatrixDisciplinedClock(MatrixClock& base = MatrixClock::system());
+
+  time_point now() const override;
+  void sleepUntil(time_point deadline) override;
+  bool waitUntil(std::condition_variable& cv,
+                 std::unique_lock<std::mutex>& lock, time_point deadline,
+                 const std::function<bool()>& pred) override;
+
+  /// Steer towards this clock reading base time plus offset, or jump there
+  /// right away if isStepping. Not thread safe against itself, only one
+  /// thread may discipline the clock.
+  void setTargetOffset(duration offset, bool isStepping = false);
+  duration getOffset() const;
+  duration getTargetOffset() const { return discipline.load().target; }
+
+  MatrixClock& getBase() { return base; }
+
+ private:
+  struct Discipline {
+    time_point anchor;  // base time the offset was last set at
+    duration offset{0};  // offset at anchor
+    duration target{0};
+  };
+
+  duration offsetAt(const Discipline& current, time_point baseTime) const;
+  time_point toBase(time_point deadline) const;
+
+  MatrixClock& base;
+  MatrixSeqlock<Discipline> discipline;
+};
@@ -0,0 +1,289 @@
+#include "MatrixCompositor.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATRIX_COMPOSITOR_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Blending kernels
+//
+// Per channel: t is the blend mode's result of source s and destination d,
+// then d moves towards t by the source alpha times the layer opacity. All
+// math is 8 bit fixed point with exact rounding division by 255.
+
+static inline int div255(int x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static void blendScalar(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                        int opacity, MatrixCompositor::eBlendMode mode) {
+  for (size_t i = 0; i < numPixels; i++, dst += 4, src += 4) {
+    int a = div255(src[3] * opacity);
+    if (a == 0) {
+      continue;
+    }
+    for (int c = 0; c < 3; c++) {
+      int s = src[c], d = dst[c], t;
+      switch (mode) {
+        case MatrixCompositor::ADD:
+          t = min(255, s + d);
+          break;
+        case MatrixCompositor::MULTIPLY:
+          t = div255(s * d);
+          break;
+        case MatrixCompositor::SCREEN:
+          t = s + d - div255(s * d);
+          break;
+        default:
+          t = s;
+          break;
+      }
+      dst[c] = uint8_t(div255(d * (255 - a) + t * a));
+    }
+  }
+}
+
+#ifdef MATRIX_COMPOSITOR_SSE2
+static inline __m128i div255(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// two pixels, widened to one 16 bit lane per channel
+template <MatrixCompositor::eBlendMode Mode>
+static inline __m128i blendPixels(__m128i s, __m128i d, __m128i opacity) {
+  __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+  a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+  a = div255(_mm_mullo_epi16(a, opacity));
+
+  __m128i t;
+  if (Mode == MatrixCompositor::ADD) {
+    t = _mm_min_epi16(_mm_add_epi16(s, d), _mm_set1_epi16(255));
+  } else if (Mode == MatrixCompositor::MULTIPLY) {
+    t = div255(_mm_mullo_epi16(s, d));
+  } else if (Mode == MatrixCompositor::SCREEN) {
+    t = _mm_sub_epi16(_mm_add_epi16(s, d), div255(_mm_mullo_epi16(s, d)));
+  } else {
+    t = s;
+  }
+
+  __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), a);
+  return div255(
+      _mm_add_epi16(_mm_mullo_epi16(d, inverse), _mm_mullo_epi16(t, a)));
+}
+
+template <MatrixCompositor::eBlendMode Mode>
+static void blendSse2(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                      int opacity) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphaMask = _mm_set1_epi32(int(0xFF000000));
+  const __m128i opacity16 = _mm_set1_epi16(short(opacity));
+
+  size_t i = 0;
+  for (; i + 4 <= numPixels; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+    // overlays are mostly transparent, leave those pixels alone
+    __m128i alpha = _mm_and_si128(s, alphaMask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xFFFF) {
+      continue;
+    }
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + 4 * i));
+    __m128i low = blendPixels<Mode>(_mm_unpacklo_epi8(s, zero),
+                                    _mm_unpacklo_epi8(d, zero), opacity16);
+    __m128i high = blendPixels<Mode>(_mm_unpackhi_epi8(s, zero),
+                                     _mm_unpackhi_epi8(d, zero), opacity16);
+    _mm_storeu_si128((__m128i*)(dst + 4 * i), _mm_packus_epi16(low, high));
+  }
+  blendScalar(dst + 4 * i, src + 4 * i, numPixels - i, opacity, Mode);
+}
+#endif
+
+static void blend(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                  int opacity, MatrixCompositor::eBlendMode mode) {
+#ifdef MATRIX_COMPOSITOR_SSE2
+  switch (mode) {
+    case MatrixCompositor::NORMAL:
+      blendSse2<MatrixCompositor::NORMAL>(dst, src, numPixels, opacity);
+      return;
+    case MatrixCompositor::ADD:
+      blendSse2<MatrixCompositor::ADD>(dst, src, numPixels, opacity);
+      return;
+    case MatrixCompositor::MULTIPLY:
+      blendSse2<MatrixCompositor::MULTIPLY>(dst, src, numPixels, opacity);
+      return;
+    case MatrixCompositor::SCREEN:
+      blendSse2<MatrixCompositor::SCREEN>(dst, src, numPixels, opacity);
+      return;
+  }
+#endif
+  blendScalar(dst, src, numPixels, opacity, mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Layers
+
+MatrixCompositor::MatrixCompositor() {
+  canvasWidth = canvasHeight = 0;
+  ringIndex = 0;
+  activeLayers = 0;
+  generation = 1;
+  for (auto& layer : layers) {
+    layer.x = layer.y = 0;
+    layer.firstRow = layer.rowCount = 0;
+    layer.opacity = 255;
+    layer.mode = NORMAL;
+  }
+}
+
+void MatrixCompositor::setSize(int width, int height) {
+  lock_guard<mutex> lk(mtx);
+  if (width == canvasWidth && height == canvasHeight) {
+    return;
+  }
+  canvasWidth = width;
+  canvasHeight = height;
+  canvas.assign(size_t(width) * height * 4, 0);
+  for (auto& image : ring) {
+    image = QImage(width, height, QImage::Format_RGB888);
+  }
+  for (auto& layer : layers) {
+    rasterize(layer);
+  }
+  updateActiveLayers();
+  generation++;
+}
+
+bool MatrixCompositor::setLayer(int layer, const QImage& image, int x,
+                                int y) {
+  if (layer < 0 || layer >= MaxLayers) {
+    return false;
+  }
+  // convert outside the lock, the reactor may be compositing
+  QImage converted = image.convertToFormat(QImage::Format_RGBA8888);
+
+  lock_guard<mutex> lk(mtx);
+  layers[layer].image = converted;
+  layers[layer].x = x;
+  layers[layer].y = y;
+  rasterize(layers[layer]);
+  updateActiveLayers();
+  generation++;
+  return true;
+}
+
+void MatrixCompositor::clearLayer(int layer) {
+  if (layer < 0 || layer >= MaxLayers) {
+    return;
+  }
+  lock_guard<mutex> lk(mtx);
+  layers[layer].image = QImage();
+  layers[layer].pixels.clear();
+  updateActiveLayers();
+  generation++;
+}
+
+void MatrixCompositor::setLayerOpacity(int layer, float opacity) {
+  if (layer < 0 || layer >= MaxLayers) {
+    return;
+  }
+  lock_guard<mutex> lk(mtx);
+  layers[layer].opacity = uint8_t(clamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+  updateActiveLayers();
+  generation++;
+}
+
+void MatrixCompositor::setLayerBlendMode(int layer, eBlendMode mode) {
+  if (layer < 0 || layer >= MaxLayers) {
+    return;
+  }
+  lock_guard<mutex> lk(mtx);
+  layers[layer].mode = mode;
+  generation++;
+}
+
+void MatrixCompositor::rasterize(Layer& layer) {
+  if (layer.image.isNull() || canvasWidth == 0 || canvasHeight == 0) {
+    layer.pixels.clear();
+    return;
+  }
+  layer.pixels.assign(size_t(canvasWidth) * canvasHeight * 4, 0);
+
+  int left = max(0, layer.x);
+  int right = min(canvasWidth, layer.x + layer.image.width());
+  int top = max(0, layer.y);
+  int bottom = min(canvasHeight, layer.y + layer.image.height());
+  layer.firstRow = top;
+  layer.rowCount = left < right ? max(0, bottom - top) : 0;
+  for (int y = top; y < bottom; y++) {
+    if (left < right) {
+      memcpy(&layer.pixels[(size_t(y) * canvasWidth + left) * 4],
+             layer.image.constScanLine(y - layer.y) + (left - layer.x) * 4,
+             size_t(right - left) * 4);
+    }
+  }
+}
+
+void MatrixCompositor::updateActiveLayers() {
+  int count = 0;
+  for (auto& layer : layers) {
+    if (!layer.pixels.empty() && layer.opacity > 0) {
+      count++;
+    }
+  }
+  activeLayers = count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Compositing
+
+QImage MatrixCompositor::composite(const QImage& base) {
+  lock_guard<mutex> lk(mtx);
+  if (activeLayers == 0 || base.width() != canvasWidth ||
+      base.height() != canvasHeight) {
+    return base;
+  }
+  const QImage& source = base.format() == QImage::Format_RGB888
+                             ? base
+                             : base.convertToFormat(QImage::Format_RGB888);
+
+  for (int y = 0; y < canvasHeight; y++) {
+    const uint8_t* line = source.constScanLine(y);
+    uint8_t* pixel = &canvas[size_t(y) * canvasWidth * 4];
+    for (int x = 0; x < canvasWidth; x++, pixel += 4, line += 3) {
+      pixel[0] = line[0];
+      pixel[1] = line[1];
+      pixel[2] = line[2];
+    }
+  }
+
+  for (auto& layer : layers) {
+    if (!layer.pixels.empty() && layer.opacity > 0) {
+      // rows outside the image are transparent, skip them entirely
+      size_t offset = size_t(layer.firstRow) * canvasWidth * 4;
+      blend(&canvas[offset], &layer.pixels[offset],
+            size_t(layer.rowCount) * canvasWidth, layer.opacity, layer.mode);
+    }
+  }
+
+  // only detaches if an output still holds a frame from RingSize calls ago
+  QImage& output = ring[ringIndex];
+  ringIndex = (ringIndex + 1) % RingSize;
+  for (int y = 0; y < canvasHeight; y++) {
+    const uint8_t* pixel = &canvas[size_t(y) * canvasWidth * 4];
+    uint8_t* line = output.scanLine(y);
+    for (int x = 0; x < canvasWidth; x++, pixel += 4, line += 3) {
+      line[0] = pixel[0];
+      line[1] = pixel[1];
+      line[2] = pixel[2];
+    }
+  }
+  return output;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/// Blends overlay layers (logo, countdown, emergency text...) over the
+/// frames of the running track, between the reactor and the outputs.
+///
+/// All storage is allocated by setSize() when a track is loaded, composing
+/// a frame allocates nothing. Layers are stored as RGBA and blended into a
+/// 32 bit working canvas with SSE2 kernels where available.
+class MatrixCompositor {
+ public:
+  enum eBlendMode {
+    NORMAL,    // alpha over
+    ADD,       // saturating sum
+    MULTIPLY,  // darkens
+    SCREEN,    // lightens
+  };
+
+  static const int MaxLayers = 8;
+
+  MatrixCompositor();
+
+  /// Canvas size, normally the size of the loaded track. Layers are kept
+  /// and laid out again on the new canvas.
+  void setSize(int width, int height);
+  int width() const { return canvasWidth; }
+  int height() const { return canvasHeight; }
+
+  /// Show image in layer at x, y, the rest of the layer is transparent.
+  /// The layer keeps its opacity and blend mode.
+  bool setLayer(int layer, const QImage& image, int x = 0, int y = 0);
+  void clearLayer(int layer);
+  void setLayerOpacity(int layer, float opacity);
+  void setLayerBlendMode(int layer, eBlendMode mode);
+
+  /// True if any layer would change a frame.
+  bool isActive() const { return activeLayers > 0; }
+
+  /// Changes whenever the layers do, equal generations compose a frame the
+  /// same way.
+  uint64_t getGeneration() const { return generation; }
+
+  /// Blend all visible layers over base into the next image of a small ring,
+  /// which is only reallocated if an output still holds it RingSize frames
+  /// later. Frames of a different size than the canvas are passed through.
+  QImage composite(const QImage& base);
+
+ private:
+  struct Layer {
+    QImage image;  // as given, RGBA8888
+    int x, y;
+    std::vector<uint8_t> pixels;  // image laid out on the canvas
+    int firstRow, rowCount;       // rows of the canvas the image covers
+    uint8_t opacity;
+    eBlendMode mode;
+  };
+
+  // outputs may still hold the last few frames while new ones are composed
+  static const int RingSize = 8;
+
+  void rasterize(Layer& layer);
+  void updateActiveLayers();
+
+  std::mutex mtx;
+  int canvasWidth, canvasHeight;
+  Layer layers[MaxLayers];
+  std::vector<uint8_t> canvas;  // RGBX
+  QImage ring[RingSize];
+  int ringIndex;
+  std::atomic<int> activeLayers;
+  std::atomic<uint64_t> generation;
+};
@@ -0,0 +1,393 @@
+#include "MatrixControlServer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "MatrixTrace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// clients that do not read their notifications are dropped past this
+static const size_t MaxPendingOutput = 64 * 1024;
+
+static const char* stateName(MatrixPlayer::eState state) {
+  switch (state) {
+    case MatrixPlayer::EMPTY:
+      return "EMPTY";
+    case MatrixPlayer::STOPPED:
+      return "STOPPED";
+    case MatrixPlayer::PAUSED:
+      return "PAUSED";
+    case MatrixPlayer::PLAYING:
+      return "PLAYING";
+  }
+  return "UNKNOWN";
+}
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+MatrixControlServer::MatrixControlServer(MatrixPlayer& player)
+    : player(player) {
+  listenFd = -1;
+  wakePipe[0] = wakePipe[1] = -1;
+  running = false;
+  frameSubscribers = 0;
+  lastTime = 0.0;
+}
+
+MatrixControlServer::~MatrixControlServer() { stop(); }
+
+bool MatrixControlServer::start(const std::string& socketPath) {
+  stop();
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    cout << "Control socket path is too long." << endl;
+    return false;
+  }
+  strcpy(address.sun_path, socketPath.c_str());
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    cout << "Failed to create control socket: " << strerror(errno) << endl;
+    return false;
+  }
+  setNonBlocking(listenFd);
+
+  // a stale socket file from a previous run would make bind fail
+  unlink(socketPath.c_str());
+  if (::bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(listenFd, 8) < 0) {
+    cout << "Failed to bind control socket " << socketPath << ": "
+         << strerror(errno) << endl;
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+
+  if (pipe(wakePipe) < 0) {
+    close(listenFd);
+    listenFd = -1;
+    unlink(socketPath.c_str());
+    return false;
+  }
+  setNonBlocking(wakePipe[0]);
+  setNonBlocking(wakePipe[1]);
+
+  this->socketPath = socketPath;
+  running = true;
+  serverThread = thread([this] { serverThreadFunc(); });
+  player.addListener(this);
+  return true;
+}
+
+void MatrixControlServer::stop() {
+  if (!serverThread.joinable()) {
+    return;
+  }
+
+  player.removeListener(this);
+  running = false;
+  wake();
+  serverThread.join();
+
+  for (auto& client : clients) {
+    close(client.fd);
+  }
+  clients.clear();
+  notifications.clear();
+  frameSubscribers = 0;
+
+  close(listenFd);
+  close(wakePipe[0]);
+  close(wakePipe[1]);
+  listenFd = wakePipe[0] = wakePipe[1] = -1;
+  unlink(socketPath.c_str());
+}
+
+void MatrixControlServer::broadcast(const std::string& line) {
+  push(line, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Player notifications, these arrive on the player's threads
+
+void MatrixControlServer::onStateChanged(MatrixPlayer::eState state) {
+  push(string("state ") + stateName(state), false);
+}
+
+void MatrixControlServer::onTimeChanged(double time) { lastTime = time; }
+
+void MatrixControlServer::onFrameChanged(const QImage& frame) {
+  // the player notifies a frame's time right before the frame
+  if (frameSubscribers > 0) {
+    push("frame " + to_string(llround(lastTime * 1000.0)), true);
+  }
+}
+
+void MatrixControlServer::onTrackEnded() { push("ended", false); }
+
+void MatrixControlServer::push(std::string line, bool isFrame) {
+  if (!running) {
+    return;
+  }
+  {
+    lock_guard<mutex> lk(notificationMutex);
+    notifications.push_back({std::move(line), isFrame});
+  }
+  wake();
+}
+
+void MatrixControlServer::wake() {
+  char byte = 0;
+  if (wakePipe[1] >= 0) {
+    ssize_t written = write(wakePipe[1], &byte, 1);
+    (void)written;  // a full pipe already guarantees a wakeup
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Event loop
+
+void MatrixControlServer::serverThreadFunc() {
+  vector<pollfd> fds;
+
+  while (running) {
+    fds.clear();
+    fds.push_back({wakePipe[0], POLLIN, 0});
+    fds.push_back({listenFd, POLLIN, 0});
+    for (auto& client : clients) {
+      short events = POLLIN;
+      if (!client.output.empty()) {
+        events |= POLLOUT;
+      }
+      fds.push_back({client.fd, events, 0});
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cout << "Control server poll failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char drain[64];
+      while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      acceptClients();
+    }
+
+    // clients accepted in this round are not in fds yet
+    for (size_t i = 2; i < fds.size(); i++) {
+      Client& client = clients[i - 2];
+      bool isAlive = !(fds[i].revents & (POLLERR | POLLNVAL));
+      if (isAlive && (fds[i].revents & (POLLIN | POLLHUP))) {
+        isAlive = readClient(client);
+      }
+      if (!isAlive) {
+        if (client.wantsFrames) {
+          frameSubscribers--;
+        }
+        close(client.fd);
+        client.fd = -1;
+      }
+    }
+
+    distributeNotifications();
+
+    for (auto& client : clients) {
+      if (client.fd >= 0 && !writeClient(client)) {
+        if (client.wantsFrames) {
+          frameSubscribers--;
+        }
+        close(client.fd);
+        client.fd = -1;
+      }
+    }
+
+    for (size_t i = 0; i < clients.size();) {
+      if (clients[i].fd < 0) {
+        clients.erase(clients.begin() + i);
+      } else {
+        i++;
+      }
+    }
+
+    player.getMetrics().updateThreadCpu(MatrixMetrics::CONTROL_THREAD);
+  }
+}
+
+void MatrixControlServer::acceptClients() {
+  int fd;
+  while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+    setNonBlocking(fd);
+    clients.push_back({fd, "", "", false});
+  }
+}
+
+bool MatrixControlServer::readClient(Client& client) {
+  char buffer[4096];
+  ssize_t received;
+  while ((received = read(client.fd, buffer, sizeof(buffer))) > 0) {
+    client.input.append(buffer, received);
+  }
+  bool isClosed =
+      received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+
+  size_t lineEnd;
+  while ((lineEnd = client.input.find('\n')) != string::npos) {
+    string command = client.input.substr(0, lineEnd);
+    client.input.erase(0, lineEnd + 1);
+    if (!command.empty() && command.back() == '\r') {
+      command.pop_back();
+    }
+    execute(client, command);
+  }
+  return !isClosed && client.input.size() < MaxPendingOutput;
+}
+
+bool MatrixControlServer::writeClient(Client& client) {
+  while (!client.output.empty()) {
+    ssize_t sent = send(client.fd, client.output.data(), client.output.size(),
+                        MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    client.output.erase(0, sent);
+  }
+  return client.output.size() < MaxPendingOutput;
+}
+
+void MatrixControlServer::execute(Client& client, const std::string& command) {
+  istringstream stream(command);
+  string verb, argument;
+  stream >> verb >> argument;
+
+  string reply = "ok";
+  if (verb == "play") {
+    player.play();
+  } else if (verb == "pause") {
+    player.pause();
+  } else if (verb == "stop") {
+    player.stop();
+  } else if (verb == "seek" && !argument.empty()) {
+    player.setTime(milliseconds(atoll(argument.c_str())));
+  } else if ((verb == "next" || verb == "prev") && SeekPlaylist) {
+    SeekPlaylist(verb == "next" ? 1 : -1);
+  } else if (verb == "volume" && !argument.empty()) {
+    player.setVolume(atoi(argument.c_str()) / 100.0f);
+  } else if (verb == "dimmer" && !argument.empty()) {
+    player.getFilterChain().setDimmer(atoi(argument.c_str()) / 100.0f);
+  } else if ((verb == "gamma" || verb == "balance") && !argument.empty()) {
+    // one value for all channels or one each for red, green and blue
+    float values[3];
+    values[0] = values[1] = values[2] = float(atof(argument.c_str()));
+    string green, blue;
+    if (stream >> green >> blue) {
+      values[1] = float(atof(green.c_str()));
+      values[2] = float(atof(blue.c_str()));
+    }
+    auto settings = player.getFilterChain().getSettings();
+    for (int c = 0; c < 3; c++) {
+      if (verb == "gamma") {
+        settings.gamma[c] = values[c];
+      } else {
+        settings.gain[c] = values[c] / 100.0f;
+      }
+    }
+    player.getFilterChain().setSettings(settings);
+  } else if (verb == "overlay" && !argument.empty()) {
+    string value;
+    stream >> value;
+    int layer = atoi(argument.c_str());
+    if (value == "clear") {
+      player.getCompositor().clearLayer(layer);
+    } else if (!value.empty()) {
+      player.getCompositor().setLayerOpacity(layer,
+                                             atoi(value.c_str()) / 100.0f);
+    } else {
+      reply = "error usage: overlay <layer> <0-100|clear>";
+    }
+  } else if (verb == "state") {
+    // one snapshot, state, time and duration always belong together
+    auto snapshot = player.getSnapshot();
+    auto time = snapshot.positionAt(player.getClock()->now());
+    reply = string("state ") + stateName((MatrixPlayer::eState)snapshot.state) +
+            " " + to_string(duration_cast<milliseconds>(time).count()) + " " +
+            to_string(duration_cast<milliseconds>(snapshot.duration).count());
+  } else if (verb == "metrics") {
+    ostringstream snapshot;
+    player.getMetrics().writeSnapshot(snapshot);
+    reply = "metrics " + snapshot.str();
+  } else if (verb == "trace" && argument == "start") {
+    if (MatrixTrace::IsCompiledIn) {
+      MatrixTrace::start();
+    } else {
+      reply = "error built without MATRIXSOURCE_TRACE";
+    }
+  } else if (verb == "trace" && argument == "stop") {
+    string path;
+    stream >> path;
+    MatrixTrace::stop();
+    if (!path.empty() && !MatrixTrace::writeJson(path)) {
+      reply = "error could not write " + path;
+    }
+  } else if (verb == "ping") {
+    reply = "pong";
+  } else if (verb == "subscribe" && argument == "frames") {
+    if (!client.wantsFrames) {
+      client.wantsFrames = true;
+      frameSubscribers++;
+    }
+  } else if (verb == "unsubscribe" && argument == "frames") {
+    if (client.wantsFrames) {
+      client.wantsFrames = false;
+      frameSubscribers--;
+    }
+  } else {
+    reply = "error unknown command: " + command;
+  }
+
+  // notifications raised by the command itself go out before the reply
+  distributeNotifications();
+  client.output += reply;
+  client.output += '\n';
+}
+
+void MatrixControlServer::distributeNotifications() {
+  vector<Notification> pending;
+  {
+    lock_guard<mutex> lk(notificationMutex);
+    pending.swap(notifications);
+  }
+  for (auto& notification : pending) {
+    for (auto& client : clients) {
+      if (client.fd >= 0 && (!notification.isFrame || client.wantsFrames)) {
+        client.output += notification.line;
+        client.output += '\n';
+      }
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixPlayer.h"
+
+/// Local control interface on a Unix domain socket.
+///
+/// The protocol is line based, one command per line:
+///   play | pause | stop | seek <ms> | next | prev | volume <0-100>
+///   overlay <layer> <0-100|clear>
+///   dimmer <0-100> | gamma <g> [<g> <g>] | balance <%> [<%> <%>]
+///   state | metrics | ping | subscribe frames | unsubscribe frames
+///   trace start | trace stop [<path>]
+/// Every command is answered with "ok", "pong", "state <name> <ms> <ms>", a
+/// one line "metrics <json>" snapshot or "error <reason>". State changes are
+/// pushed to all clients as "state <name>" and "ended", presented frames as
+/// "frame <ms>" to clients that subscribed to them. "trace stop" writes what
+/// was recorded since "trace start" to path as a Chrome trace.
+///
+/// Commands are executed on the server's own poll loop and go straight to
+/// MatrixPlayer, they never pass through a GUI event loop.
+class MatrixControlServer : public MatrixPlayerListener {
+ public:
+  MatrixControlServer(MatrixPlayer& player);
+  ~MatrixControlServer();
+
+  bool start(const std::string& socketPath);
+  void stop();
+  bool isRunning() const { return running; }
+
+  /// Push an arbitrary notification line to every client.
+  void broadcast(const std::string& line);
+
+  // --- Playlist navigation, called with +1/-1 for next/prev --- //
+  std::function<void(intptr_t offset)> SeekPlaylist;
+
+  void onStateChanged(MatrixPlayer::eState) override;
+  void onTimeChanged(double time) override;
+  void onFrameChanged(const QImage& frame) override;
+  void onTrackEnded() override;
+
+ private:
+  struct Client {
+    int fd;
+    std::string input;
+    std::string output;
+    bool wantsFrames;
+  };
+
+  struct Notification {
+    std::string line;
+    bool isFrame;
+  };
+
+  void serverThreadFunc();
+  void acceptClients();
+  bool readClient(Client& client);
+  bool writeClient(Client& client);
+  void execute(Client& client, const std::string& command);
+  void distributeNotifications();
+  void push(std::string line, bool isFrame);
+  void wake();
+
+  MatrixPlayer& player;
+  std::string socketPath;
+  int listenFd;
+  int wakePipe[2];
+  std::thread serverThread;
+  std::atomic_bool running;
+
+  std::vector<Client> clients;
+  std::mutex notificationMutex;
+  std::vector<Notification> notifications;
+  std::atomic<int> frameSubscribers;
+  std::atomic<double> lastTime;
+};
@@ -0,0 +1,190 @@
+#include "MatrixFilterChain.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATRIX_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// Filtering kernels
+//
+// Pixels are RGB888, tightly packed within a run. Both kernels give the
+// same result for linear tables, the SSE2 one just computes the scale
+// instead of looking it up.
+
+static void lookupScalar(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                         const uint8_t (*lut)[256]) {
+  const uint8_t* red = lut[0];
+  const uint8_t* green = lut[1];
+  const uint8_t* blue = lut[2];
+  for (size_t i = 0; i < numPixels; i++, dst += 3, src += 3) {
+    dst[0] = red[src[0]];
+    dst[1] = green[src[1]];
+    dst[2] = blue[src[2]];
+  }
+}
+
+#ifdef MATRIX_FILTER_SSE2
+// 16 pixels per round, three registers in which the channels repeat with a
+// period of three bytes, each widened to two halves of 16 bit lanes
+static void scaleSse2(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                      const uint16_t* scale, const uint8_t (*lut)[256]) {
+  __m128i scales[6];
+  for (int half = 0; half < 6; half++) {
+    uint16_t lanes[8];
+    for (int lane = 0; lane < 8; lane++) {
+      lanes[lane] = scale[(8 * half + lane) % 3];
+    }
+    scales[half] = _mm_loadu_si128((const __m128i*)lanes);
+  }
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+
+  size_t i = 0;
+  for (; i + 16 <= numPixels; i += 16) {
+    for (int part = 0; part < 3; part++) {
+      size_t offset = 3 * i + 16 * part;
+      __m128i x = _mm_loadu_si128((const __m128i*)(src + offset));
+      // at most 255 * 256 + 128, no 16 bit lane overflows
+      __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero),
+                                    scales[2 * part]);
+      __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero),
+                                     scales[2 * part + 1]);
+      low = _mm_srli_epi16(_mm_add_epi16(low, round), 8);
+      high = _mm_srli_epi16(_mm_add_epi16(high, round), 8);
+      _mm_storeu_si128((__m128i*)(dst + offset), _mm_packus_epi16(low, high));
+    }
+  }
+  lookupScalar(dst + 3 * i, src + 3 * i, numPixels - i, lut);
+}
+#endif
+
+static void filter(uint8_t* dst, const uint8_t* src, size_t numPixels,
+                   const uint8_t (*lut)[256], const uint16_t* scale,
+                   bool isLinear) {
+#ifdef MATRIX_FILTER_SSE2
+  if (isLinear) {
+    scaleSse2(dst, src, numPixels, scale, lut);
+    return;
+  }
+#endif
+  lookupScalar(dst, src, numPixels, lut);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Settings
+
+MatrixFilterChain::MatrixFilterChain() {
+  frameWidth = frameHeight = 0;
+  ringIndex = 0;
+  generation = 0;
+  lock_guard<mutex> lk(settingsMutex);
+  publish();
+}
+
+void MatrixFilterChain::setSize(int width, int height) {
+  lock_guard<mutex> lk(frameMutex);
+  if (width == frameWidth && height == frameHeight) {
+    return;
+  }
+  frameWidth = width;
+  frameHeight = height;
+  for (auto& image : ring) {
+    image = QImage(width, height, QImage::Format_RGB888);
+  }
+}
+
+void MatrixFilterChain::setSettings(const Settings& settings) {
+  lock_guard<mutex> lk(settingsMutex);
+  this->settings = settings;
+  publish();
+}
+
+auto MatrixFilterChain::getSettings() const -> Settings {
+  lock_guard<mutex> lk(settingsMutex);
+  return settings;
+}
+
+void MatrixFilterChain::setDimmer(float dimmer) {
+  lock_guard<mutex> lk(settingsMutex);
+  settings.dimmer = dimmer;
+  publish();
+}
+
+void MatrixFilterChain::publish() {
+  Tables compiled = compile(settings);
+  bool isIdentity = true;
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 256; v++) {
+      isIdentity = isIdentity && compiled.lut[c][v] == v;
+    }
+  }
+  tables.store(compiled);
+  active = !isIdentity;
+  generation++;
+}
+
+auto MatrixFilterChain::compile(const Settings& settings) -> Tables {
+  Tables compiled;
+  compiled.isLinear = true;
+  float dimmer = min(max(settings.dimmer, 0.0f), 1.0f);
+  for (int c = 0; c < 3; c++) {
+    float gain = min(max(settings.gain[c], 0.0f), 4.0f);
+    float gamma = min(max(settings.gamma[c], 0.1f), 10.0f);
+    int scale = int(lround(dimmer * gain * 256));
+    compiled.scale[c] = uint16_t(scale);
+    // a boost has to saturate, which only the table does
+    bool isGammaLinear = gamma == 1.0f;
+    if (!isGammaLinear || scale > 256) {
+      compiled.isLinear = false;
+    }
+
+    for (int v = 0; v < 256; v++) {
+      int curved = isGammaLinear
+                       ? v
+                       : int(lround(255 * pow(v / 255.0, double(gamma))));
+      compiled.lut[c][v] = uint8_t(min((curved * scale + 128) >> 8, 255));
+    }
+  }
+  return compiled;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Filtering
+
+QImage MatrixFilterChain::apply(const QImage& frame) {
+  lock_guard<mutex> lk(frameMutex);
+  if (!active || frame.width() != frameWidth ||
+      frame.height() != frameHeight) {
+    return frame;
+  }
+  // one consistent set, however often the settings change meanwhile
+  Tables current = tables.load();
+  const QImage& source = frame.format() == QImage::Format_RGB888
+                             ? frame
+                             : frame.convertToFormat(QImage::Format_RGB888);
+
+  // only detaches if an output still holds a frame from RingSize calls ago
+  QImage& output = ring[ringIndex];
+  ringIndex = (ringIndex + 1) % RingSize;
+  size_t lineSize = size_t(frameWidth) * 3;
+  if (source.bytesPerLine() == qsizetype(lineSize) &&
+      output.bytesPerLine() == qsizetype(lineSize)) {
+    // no padding at the line ends, the whole frame is one run
+    filter(output.bits(), source.constBits(),
+           size_t(frameWidth) * frameHeight, current.lut, current.scale,
+           current.isLinear);
+    return output;
+  }
+  for (int y = 0; y < frameHeight; y++) {
+    filter(output.scanLine(y), source.constScanLine(y), size_t(frameWidth),
+           current.lut, current.scale, current.isLinear);
+  }
+  return output;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "MatrixSeqlock.h"
+
+/// Per channel corrections of every frame on its way to the outputs: a
+/// master dimmer for night time regulations, color balance gains and a
+/// gamma matching the LEDs' response. Runs after the compositor.
+///
+/// All stages fold into one 256 entry table per channel, so a frame costs
+/// three lookups per pixel whatever is set. Without gamma and without any
+/// gain above 1 the tables are a plain scale, which runs as an SSE2 kernel
+/// where available and gives the same result.
+///
+/// Settings can be changed from any thread while frames are filtered. They
+/// reach the reactor through a seqlock, filtering never waits for a change
+/// and never allocates once setSize() has run.
+class MatrixFilterChain {
+ public:
+  struct Settings {
+    float dimmer = 1;            // 0 to 1, scales every channel
+    float gain[3] = {1, 1, 1};   // red, green, blue, 0 to 4
+    float gamma[3] = {1, 1, 1};  // out = in ^ gamma, 0.1 to 10
+  };
+
+  MatrixFilterChain();
+
+  /// Size of the filtered frames, normally the size of the loaded track.
+  void setSize(int width, int height);
+
+  void setSettings(const Settings& settings);
+  Settings getSettings() const;
+  void setDimmer(float dimmer);
+
+  /// True unless the settings leave every frame as it is.
+  bool isActive() const { return active; }
+
+  /// Changes whenever the settings do, equal generations filter a frame
+  /// the same way.
+  uint64_t getGeneration() const { return generation; }
+
+  /// Filter frame into the next image of a small ring, which is only
+  /// reallocated if an output still holds it RingSize frames later. Frames
+  /// of a different size are passed through.
+  QImage apply(const QImage& frame);
+
+ private:
+  // what the settings compile to, copied by every apply()
+  struct Tables {
+    uint8_t lut[3][256];
+    uint16_t scale[3];  // 8.8 fixed point, only used if isLinear
+    bool isLinear;      // lut[c][v] == (v * scale[c] + 128) >> 8
+  };
+
+  // outputs may still hold the last few frames while new ones are filtered
+  static const int RingSize = 8;
+
+  static Tables compile(const Settings& settings);
+  // hands the current settings to apply(), with settingsMutex held
+  void publish();
+
+  mutable std::mutex settingsMutex;  // serializes writers only
+  Settings settings;
+  MatrixSeqlock<Tables> tables;
+  std::atomic_bool active;
+  std::atomic<uint64_t> generation;
+
+  // taken by apply() and setSize() only, never contended while playing
+  std::mutex frameMutex;
+  int frameWidth, frameHeight;
+  QImage ring[RingSize];
+  int ringIndex;
+};
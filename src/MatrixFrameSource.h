@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QImage>
+#include <cstdint>
+
+#include "MatrixClock.h"
+
+/// Frames made while playing instead of decoded up front, e.g. rendered by
+/// another process. The video player takes the newest one on every frame
+/// tick, frames made in between are never shown.
+class MatrixFrameSource {
+ public:
+  struct Frame {
+    QImage image;  // may point into memory of the source, read only
+    uint64_t sequence = 0;  // grows with every new frame
+    MatrixClock::time_point writeTime;  // the producer finished the frame
+  };
+
+  virtual ~MatrixFrameSource() = default;
+
+  virtual int width() const = 0;
+  virtual int height() const = 0;
+
+  /// Newest complete frame, false while there is none yet. Called on the
+  /// reactor, so it must not block.
+  virtual bool acquire(Frame& frame) = 0;
+};
@@ -0,0 +1,269 @@
+#include "MatrixLibrary.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+namespace fs = std::filesystem;
+
+static const char* IndexHeader = "matrixlibrary v1";
+
+MatrixLibrary::MatrixLibrary() {}
+
+////////////////////////////////////////////////////////////////////////////////
+// Index file
+
+// fields are tab separated, keep titles from breaking the line structure
+static string sanitize(string text) {
+  replace(text.begin(), text.end(), '\t', ' ');
+  replace(text.begin(), text.end(), '\n', ' ');
+  replace(text.begin(), text.end(), '\r', ' ');
+  return text;
+}
+
+bool MatrixLibrary::loadIndex(const std::string& indexPath) {
+  ifstream inputFile(indexPath);
+  if (!inputFile.is_open()) {
+    return !fs::exists(indexPath);
+  }
+
+  string line;
+  if (!getline(inputFile, line) || line != IndexHeader) {
+    cout << "Unknown library index format: " << indexPath << endl;
+    return false;
+  }
+
+  map<string, Entry> loaded;
+  while (getline(inputFile, line)) {
+    // split by hand, empty trailing fields (no title) must survive
+    vector<string> fields;
+    size_t start = 0, end;
+    while ((end = line.find('\t', start)) != string::npos) {
+      fields.push_back(line.substr(start, end - start));
+      start = end + 1;
+    }
+    fields.push_back(line.substr(start));
+    if (fields.size() != 11) {
+      continue;  // damaged line, the file is probed again on the next scan
+    }
+
+    Entry entry;
+    try {
+      entry.path = fields[0];
+      entry.fileSize = stoull(fields[1]);
+      entry.modifiedTime = stoll(fields[2]);
+      entry.isValid = fields[3] == "1";
+      entry.info.width = stoul(fields[4]);
+      entry.info.height = stoul(fields[5]);
+      entry.info.frameCount = stoul(fields[6]);
+      entry.info.duration = microseconds(stoll(fields[7]));
+      entry.info.hasAudio = fields[8] == "1";
+      entry.info.title = fields[9];
+      entry.info.audio = fields[10];
+    } catch (const exception&) {
+      continue;
+    }
+    loaded[entry.path] = entry;
+  }
+
+  lock_guard<mutex> lk(mtx);
+  for (auto& item : loaded) {
+    entries[item.first] = std::move(item.second);
+  }
+  return true;
+}
+
+bool MatrixLibrary::saveIndex(const std::string& indexPath) const {
+  string tempPath = indexPath + ".tmp";
+  {
+    ofstream outputFile(tempPath, ios::trunc);
+    if (!outputFile.is_open()) {
+      cout << "Could not write library index " << indexPath << endl;
+      return false;
+    }
+
+    outputFile << IndexHeader << '\n';
+    lock_guard<mutex> lk(mtx);
+    for (auto& item : entries) {
+      const Entry& entry = item.second;
+      if (entry.path.find_first_of("\t\n\r") != string::npos) {
+        continue;
+      }
+      outputFile << entry.path << '\t' << entry.fileSize << '\t'
+                 << entry.modifiedTime << '\t' << entry.isValid << '\t'
+                 << entry.info.width << '\t' << entry.info.height << '\t'
+                 << entry.info.frameCount << '\t'
+                 << entry.info.duration.count() << '\t'
+                 << entry.info.hasAudio << '\t' << sanitize(entry.info.title)
+                 << '\t' << sanitize(entry.info.audio) << '\n';
+    }
+    if (!outputFile.flush()) {
+      cout << "Could not write library index " << indexPath << endl;
+      return false;
+    }
+  }
+
+  error_code error;
+  fs::rename(tempPath, indexPath, error);
+  if (error) {
+    cout << "Could not replace library index " << indexPath << ": "
+         << error.message() << endl;
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Scanning
+
+static bool isQ4XFile(const fs::path& path) {
+  string extension = path.extension().string();
+  transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return tolower(c); });
+  return extension == ".q4x";
+}
+
+size_t MatrixLibrary::scanDirectory(const std::string& directory,
+                                    bool isRecursive) {
+  vector<string> paths;
+  error_code error;
+  auto options = fs::directory_options::skip_permission_denied;
+  auto collect = [&](const fs::directory_entry& item) {
+    error_code statError;
+    if (item.is_regular_file(statError) && isQ4XFile(item.path())) {
+      paths.push_back(item.path().string());
+    }
+  };
+  if (isRecursive) {
+    for (fs::recursive_directory_iterator it(directory, options, error), end;
+         !error && it != end; it.increment(error)) {
+      collect(*it);
+    }
+  } else {
+    for (fs::directory_iterator it(directory, options, error), end;
+         !error && it != end; it.increment(error)) {
+      collect(*it);
+    }
+  }
+  if (error) {
+    cout << "Could not scan " << directory << ": " << error.message() << endl;
+  }
+
+  // forget files that disappeared from the directory
+  string prefix = fs::path(directory).string();
+  if (!prefix.empty() && prefix.back() != '/' && prefix.back() != '\\') {
+    prefix += fs::path::preferred_separator;
+  }
+  {
+    vector<string> found = paths;
+    sort(found.begin(), found.end());
+    lock_guard<mutex> lk(mtx);
+    for (auto it = entries.begin(); it != entries.end();) {
+      bool isInDirectory = it->first.compare(0, prefix.size(), prefix) == 0;
+      if (isInDirectory &&
+          !binary_search(found.begin(), found.end(), it->first)) {
+        it = entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  return probe(paths);
+}
+
+size_t MatrixLibrary::scanFiles(const std::vector<std::string>& paths) {
+  return probe(paths);
+}
+
+size_t MatrixLibrary::probe(const std::vector<std::string>& paths) {
+  // stat everything first, only new or changed files are parsed
+  vector<Entry> pending;
+  for (const string& path : paths) {
+    error_code error;
+    Entry entry;
+    entry.path = path;
+    entry.fileSize = fs::file_size(path, error);
+    if (!error) {
+      entry.modifiedTime =
+          fs::last_write_time(path, error).time_since_epoch().count();
+    }
+
+    lock_guard<mutex> lk(mtx);
+    auto it = entries.find(path);
+    if (error) {
+      if (it != entries.end()) {
+        entries.erase(it);
+      }
+      continue;
+    }
+    if (it != entries.end() && it->second.fileSize == entry.fileSize &&
+        it->second.modifiedTime == entry.modifiedTime) {
+      continue;
+    }
+    pending.push_back(std::move(entry));
+  }
+
+  // files are independent, hand them out to one worker per core
+  atomic<size_t> nextFile(0);
+  auto worker = [&] {
+    size_t index;
+    while ((index = nextFile++) < pending.size()) {
+      Entry& entry = pending[index];
+      entry.isValid = Q4XLoader::probe(entry.path, entry.info);
+      if (!entry.isValid) {
+        entry.info = Q4XLoader::Info();
+      }
+    }
+  };
+
+  vector<thread> workers;
+  size_t numWorkers =
+      min<size_t>(max(1u, thread::hardware_concurrency()), pending.size());
+  for (size_t i = 1; i < numWorkers; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  lock_guard<mutex> lk(mtx);
+  for (Entry& entry : pending) {
+    entries[entry.path] = std::move(entry);
+  }
+  return pending.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// State
+
+bool MatrixLibrary::find(const std::string& path, Entry& entry) const {
+  lock_guard<mutex> lk(mtx);
+  auto it = entries.find(path);
+  if (it == entries.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+std::vector<MatrixLibrary::Entry> MatrixLibrary::getEntries() const {
+  lock_guard<mutex> lk(mtx);
+  vector<Entry> result;
+  result.reserve(entries.size());
+  for (auto& item : entries) {
+    result.push_back(item.second);
+  }
+  return result;
+}
+
+size_t MatrixLibrary::size() const {
+  lock_guard<mutex> lk(mtx);
+  return entries.size();
+}
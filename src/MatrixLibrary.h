@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Q4XLoader.h"
+
+/// Metadata of every q4x file seen so far, so playlists can show durations
+/// and flag broken files without loading any show.
+///
+/// Files are probed in parallel, one worker per core. The index is keyed by
+/// path and remembers each file's size and modification time, a rescan only
+/// probes files that are new or changed since.
+class MatrixLibrary {
+ public:
+  struct Entry {
+    std::string path;
+    uint64_t fileSize;
+    int64_t modifiedTime;  // opaque filesystem timestamp
+    bool isValid;          // false if Q4XLoader::probe() rejected it
+    Q4XLoader::Info info;
+  };
+
+  MatrixLibrary();
+
+  /// Index file: a "matrixlibrary v1" line, then one tab separated line
+  /// per file. A missing index file is not an error, it just starts empty.
+  bool loadIndex(const std::string& indexPath);
+  /// Written to a temporary file first, a crash never leaves half an index.
+  bool saveIndex(const std::string& indexPath) const;
+
+  /// Probe all .q4x files under directory. Entries of files that were
+  /// removed from it are dropped. Returns the number of files probed.
+  size_t scanDirectory(const std::string& directory, bool isRecursive = true);
+  /// Probe the given files, e.g. the ones just added to a playlist.
+  size_t scanFiles(const std::vector<std::string>& paths);
+
+  // --- Get state --- //
+  bool find(const std::string& path, Entry& entry) const;
+  std::vector<Entry> getEntries() const;
+  size_t size() const;
+
+ private:
+  size_t probe(const std::vector<std::string>& paths);
+
+  mutable std::mutex mtx;
+  std::map<std::string, Entry> entries;
+};
@@ -0,0 +1,236 @@
+#include "MatrixMetrics.h"
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+////////////////////////////////////////////////////////////////////////////////
+// Histogram
+
+MatrixHistogram::MatrixHistogram() { reset(); }
+
+int MatrixHistogram::bucketIndex(uint64_t magnitude) {
+  const uint64_t maxValue = (uint64_t(1) << MaxValueBits) - 1;
+  if (magnitude > maxValue) {
+    magnitude = maxValue;
+  }
+  if (magnitude < 2 * SubBucketHalf) {
+    return int(magnitude);
+  }
+
+  int msb = 63;
+  while (!(magnitude >> msb)) {
+    msb--;
+  }
+  int shift = msb - (SubBucketBits - 1);
+  return (shift + 1) * SubBucketHalf +
+         int((magnitude >> shift) - SubBucketHalf);
+}
+
+uint64_t MatrixHistogram::bucketValue(int index) {
+  if (index < 2 * SubBucketHalf) {
+    return index;
+  }
+
+  // middle of the bucket's range
+  int shift = index / SubBucketHalf - 1;
+  uint64_t sub = index % SubBucketHalf + SubBucketHalf;
+  return (sub << shift) + (uint64_t(1) << shift) / 2;
+}
+
+void MatrixHistogram::record(int64_t valueUs) {
+  if (valueUs >= 0) {
+    positive[bucketIndex(valueUs)].fetch_add(1, memory_order_relaxed);
+  } else {
+    negative[bucketIndex(-valueUs)].fetch_add(1, memory_order_relaxed);
+  }
+  count.fetch_add(1, memory_order_relaxed);
+  sum.fetch_add(valueUs, memory_order_relaxed);
+
+  int64_t current = minValue.load(memory_order_relaxed);
+  while (valueUs < current &&
+         !minValue.compare_exchange_weak(current, valueUs,
+                                     memory_order_relaxed)) {
+  }
+  current = maxValue.load(memory_order_relaxed);
+  while (valueUs > current &&
+         !maxValue.compare_exchange_weak(current, valueUs,
+                                     memory_order_relaxed)) {
+  }
+}
+
+auto MatrixHistogram::snapshot() const -> Snapshot {
+  Snapshot result = {};
+
+  uint64_t negativeCounts[BucketCount], positiveCounts[BucketCount];
+  uint64_t total = 0;
+  for (int i = 0; i < BucketCount; i++) {
+    negativeCounts[i] = negative[i].load(memory_order_relaxed);
+    positiveCounts[i] = positive[i].load(memory_order_relaxed);
+    total += negativeCounts[i] + positiveCounts[i];
+  }
+  if (total == 0) {
+    return result;
+  }
+
+  result.count = total;
+  result.min = minValue.load(memory_order_relaxed);
+  result.max = maxValue.load(memory_order_relaxed);
+  result.mean = double(sum.load(memory_order_relaxed)) /
+                double(count.load(memory_order_relaxed));
+
+  // walk from the most negative bucket to the most positive one
+  struct Quantile {
+    double fraction;
+    int64_t* value;
+  } quantiles[] = {{0.5, &result.p50},
+                   {0.9, &result.p90},
+                   {0.99, &result.p99},
+                   {0.999, &result.p999}};
+  size_t nextQuantile = 0;
+  uint64_t seen = 0;
+  auto visit = [&](uint64_t bucketCount, int64_t value) {
+    seen += bucketCount;
+    while (nextQuantile < 4 &&
+           seen >= quantiles[nextQuantile].fraction * total) {
+      *quantiles[nextQuantile].value = value;
+      nextQuantile++;
+    }
+  };
+  for (int i = BucketCount - 1; i >= 0; i--) {
+    visit(negativeCounts[i], -int64_t(bucketValue(i)));
+  }
+  for (int i = 0; i < BucketCount; i++) {
+    visit(positiveCounts[i], int64_t(bucketValue(i)));
+  }
+
+  return result;
+}
+
+void MatrixHistogram::reset() {
+  for (int i = 0; i < BucketCount; i++) {
+    positive[i] = 0;
+    negative[i] = 0;
+  }
+  count = 0;
+  sum = 0;
+  minValue = numeric_limits<int64_t>::max();
+  maxValue = numeric_limits<int64_t>::min();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Metrics
+
+static const char* threadNames[MatrixMetrics::THREAD_COUNT] = {"reactor",
+                                                               "control"};
+
+MatrixMetrics::MatrixMetrics() {
+  framesSent = 0;
+  framesSkipped = 0;
+  framesDropped = 0;
+  for (auto& cpu : threadCpuUs) {
+    cpu = 0;
+  }
+}
+
+void MatrixMetrics::updateThreadCpu(eThread thread) {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    auto ticks = [](FILETIME time) {
+      return int64_t(time.dwHighDateTime) << 32 | time.dwLowDateTime;
+    };
+    threadCpuUs[thread].store((ticks(kernel) + ticks(user)) / 10,
+                              memory_order_relaxed);
+  }
+#else
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0) {
+    threadCpuUs[thread].store(
+        int64_t(time.tv_sec) * 1000000 + time.tv_nsec / 1000,
+        memory_order_relaxed);
+  }
+#endif
+}
+
+std::chrono::microseconds MatrixMetrics::getThreadCpu(eThread thread) const {
+  return microseconds(threadCpuUs[thread].load(memory_order_relaxed));
+}
+
+void MatrixMetrics::reset() {
+  frameInterval.reset();
+  frameLateness.reset();
+  presentDuration.reset();
+  sendDuration.reset();
+  composeDuration.reset();
+  filterDuration.reset();
+  controlLatency.reset();
+  avOffset.reset();
+  liveLatency.reset();
+  framesSent = 0;
+  framesSkipped = 0;
+  framesDropped = 0;
+}
+
+void MatrixMetrics::writeSnapshot(std::ostream& os) const {
+  auto writeHistogram = [&os](const char* name,
+                              const MatrixHistogram& histogram) {
+    auto snapshot = histogram.snapshot();
+    os << "\"" << name << "\":{\"count\":" << snapshot.count
+       << ",\"min\":" << snapshot.min << ",\"mean\":" << snapshot.mean
+       << ",\"p50\":" << snapshot.p50 << ",\"p90\":" << snapshot.p90
+       << ",\"p99\":" << snapshot.p99 << ",\"p999\":" << snapshot.p999
+       << ",\"max\":" << snapshot.max << "},";
+  };
+
+  os << "{\"unit\":\"us\",";
+  writeHistogram("frameInterval", frameInterval);
+  writeHistogram("frameLateness", frameLateness);
+  writeHistogram("presentDuration", presentDuration);
+  writeHistogram("sendDuration", sendDuration);
+  writeHistogram("composeDuration", composeDuration);
+  writeHistogram("filterDuration", filterDuration);
+  writeHistogram("controlLatency", controlLatency);
+  writeHistogram("avOffset", avOffset);
+  writeHistogram("liveLatency", liveLatency);
+  os << "\"framesSent\":" << framesSent.load(memory_order_relaxed)
+     << ",\"framesSkipped\":" << framesSkipped.load(memory_order_relaxed)
+     << ",\"framesDropped\":" << framesDropped.load(memory_order_relaxed)
+     << ",";
+  os << "\"threadCpu\":{";
+  for (int i = 0; i < THREAD_COUNT; i++) {
+    os << (i > 0 ? "," : "") << "\"" << threadNames[i]
+       << "\":" << threadCpuUs[i].load(memory_order_relaxed);
+  }
+  os << "}}";
+}
+
+bool MatrixMetrics::writeSnapshot(const std::string& filePath) const {
+  // write aside and rename, readers never see a half written file
+  string temporaryPath = filePath + ".tmp";
+  {
+    ofstream outputFile(temporaryPath, ios::trunc);
+    if (!outputFile.is_open()) {
+      return false;
+    }
+    writeSnapshot(outputFile);
+    outputFile << endl;
+    if (!outputFile) {
+      return false;
+    }
+  }
+#ifdef _WIN32
+  remove(filePath.c_str());
+#endif
+  return rename(temporaryPath.c_str(), filePath.c_str()) == 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Lock-free log-linear histogram of signed microsecond values.
+///
+/// Buckets are exact below 64 us and have 1/32 (~3%) relative width above,
+/// in the spirit of HdrHistogram. Recording is a handful of relaxed atomic
+/// adds, so it is safe to call from the reactor on every frame.
+class MatrixHistogram {
+ public:
+  struct Snapshot {
+    uint64_t count;
+    int64_t min, max;
+    double mean;
+    int64_t p50, p90, p99, p999;
+  };
+
+  MatrixHistogram();
+
+  void record(int64_t valueUs);
+  template <class Rep, class Period>
+  void record(std::chrono::duration<Rep, Period> value) {
+    record(
+        std::chrono::duration_cast<std::chrono::microseconds>(value).count());
+  }
+
+  Snapshot snapshot() const;
+  void reset();
+
+ private:
+  static const int SubBucketBits = 6;
+  static const int SubBucketHalf = 1 << (SubBucketBits - 1);
+  static const int MaxValueBits = 36;  // ~19 hours, larger values are clamped
+  static const int BucketCount =
+      (MaxValueBits - SubBucketBits + 2) * SubBucketHalf;
+
+  static int bucketIndex(uint64_t magnitude);
+  static uint64_t bucketValue(int index);
+
+  // non-negative values in positive[], negative ones by magnitude in negative[]
+  std::atomic<uint64_t> positive[BucketCount];
+  std::atomic<uint64_t> negative[BucketCount];
+  std::atomic<uint64_t> count;
+  std::atomic<int64_t> sum;
+  std::atomic<int64_t> minValue;
+  std::atomic<int64_t> maxValue;
+};
+
+/// Always-on playback instrumentation of one player.
+class MatrixMetrics {
+ public:
+  enum eThread {
+    REACTOR_THREAD,  // frame timing, A/V sync and the audio service
+    CONTROL_THREAD,
+    THREAD_COUNT,
+  };
+
+  MatrixHistogram frameInterval;    // time between two presented frames
+  MatrixHistogram frameLateness;    // presentation instant minus its deadline
+  MatrixHistogram presentDuration;  // whole PresentFrame call
+  MatrixHistogram sendDuration;     // one output's send alone
+  MatrixHistogram composeDuration;  // blending the overlay layers
+  MatrixHistogram filterDuration;   // dimmer, color balance and gamma
+  MatrixHistogram controlLatency;   // control task queued until executed
+  MatrixHistogram avOffset;         // audio time minus video time at sync
+  MatrixHistogram liveLatency;      // live frame written until presented
+
+  std::atomic<uint64_t> framesSent;     // frames handed to an output
+  std::atomic<uint64_t> framesSkipped;  // unchanged frames not sent again
+  std::atomic<uint64_t> framesDropped;  // frames a slow output never got to
+
+  MatrixMetrics();
+
+  /// Sample the CPU time consumed so far by the calling thread.
+  void updateThreadCpu(eThread thread);
+  std::chrono::microseconds getThreadCpu(eThread thread) const;
+
+  void reset();
+
+  /// Write a JSON snapshot of every histogram and thread counter.
+  void writeSnapshot(std::ostream& os) const;
+  bool writeSnapshot(const std::string& filePath) const;
+
+ private:
+  std::atomic<int64_t> threadCpuUs[THREAD_COUNT];
+};
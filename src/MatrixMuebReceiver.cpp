@@ -0,0 +1,179 @@
+#include "MatrixMuebReceiver.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+MatrixMuebReceiver::MatrixMuebReceiver(const MatrixWireFormat& format)
+    : format(format) {
+  socketFd = -1;
+  wakePipe[0] = wakePipe[1] = -1;
+  running = false;
+  receivedCount = 0;
+  lastPacket = -1;
+  datagrams = bytes = frames = 0;
+  incompleteFrames = lostPackets = malformed = 0;
+}
+
+MatrixMuebReceiver::~MatrixMuebReceiver() { stop(); }
+
+bool MatrixMuebReceiver::start(const std::string& address) {
+  stop();
+
+  if (!format.isValid()) {
+    cout << "Invalid MUEB wire format." << endl;
+    return false;
+  }
+
+  sockaddr_in bindAddress;
+  memset(&bindAddress, 0, sizeof(bindAddress));
+  bindAddress.sin_family = AF_INET;
+  bindAddress.sin_port = htons(format.port);
+  if (inet_pton(AF_INET, address.c_str(), &bindAddress.sin_addr) != 1) {
+    cout << "Invalid receiver address " << address << endl;
+    return false;
+  }
+
+  socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socketFd < 0) {
+    cout << "Failed to create receiver socket: " << strerror(errno) << endl;
+    return false;
+  }
+  setNonBlocking(socketFd);
+
+  // a full frame arrives as one burst, do not lose it to a small buffer
+  int bufferSize = 4 * 1024 * 1024;
+  setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &bufferSize,
+             sizeof(bufferSize));
+  int reuse = 1;
+  setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if (::bind(socketFd, (sockaddr*)&bindAddress, sizeof(bindAddress)) < 0) {
+    cout << "Failed to bind receiver to " << address << ":" << format.port
+         << ": " << strerror(errno) << endl;
+    close(socketFd);
+    socketFd = -1;
+    return false;
+  }
+
+  if (pipe(wakePipe) < 0) {
+    close(socketFd);
+    socketFd = -1;
+    return false;
+  }
+  setNonBlocking(wakePipe[0]);
+  setNonBlocking(wakePipe[1]);
+
+  frame = QImage(format.width(), format.height(), QImage::Format_RGB888);
+  isReceived.assign(format.packetCount(), false);
+  receivedCount = 0;
+  lastPacket = -1;
+
+  running = true;
+  receiverThread = thread([this] { receiverThreadFunc(); });
+  return true;
+}
+
+void MatrixMuebReceiver::stop() {
+  if (!receiverThread.joinable()) {
+    return;
+  }
+
+  running = false;
+  char byte = 0;
+  ssize_t written = write(wakePipe[1], &byte, 1);
+  (void)written;
+  receiverThread.join();
+
+  close(socketFd);
+  close(wakePipe[0]);
+  close(wakePipe[1]);
+  socketFd = wakePipe[0] = wakePipe[1] = -1;
+}
+
+auto MatrixMuebReceiver::getStats() const -> Stats {
+  return {datagrams, bytes, frames, incompleteFrames, lostPackets, malformed};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Receiver thread
+
+void MatrixMuebReceiver::receiverThreadFunc() {
+  vector<uint8_t> buffer(65536);
+
+  while (running) {
+    pollfd fds[2] = {{wakePipe[0], POLLIN, 0}, {socketFd, POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cout << "Receiver poll failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    ssize_t received;
+    while ((received = recv(socketFd, buffer.data(), buffer.size(), 0)) >=
+           0) {
+      receive(buffer.data(), received);
+    }
+  }
+}
+
+void MatrixMuebReceiver::receive(const uint8_t* data, size_t size) {
+  datagrams++;
+  bytes += size;
+
+  // peek at the packet number before touching the frame being assembled
+  if (size < MatrixWireFormat::HeaderSize) {
+    malformed++;
+    return;
+  }
+  int packet = data[1];
+  if (packet <= lastPacket ||
+      (packet < (int)isReceived.size() && isReceived[packet])) {
+    abandonFrame();
+  }
+
+  if (format.decode(data, size, frame) < 0) {
+    malformed++;
+    return;
+  }
+  isReceived[packet] = true;
+  receivedCount++;
+  lastPacket = packet;
+
+  if (receivedCount == format.packetCount()) {
+    auto arrival = MatrixClock::system().now();
+    frames++;
+    if (FrameReceived) {
+      FrameReceived(frame, arrival);
+    }
+    isReceived.assign(isReceived.size(), false);
+    receivedCount = 0;
+    lastPacket = -1;
+  }
+}
+
+void MatrixMuebReceiver::abandonFrame() {
+  if (receivedCount > 0) {
+    incompleteFrames++;
+    lostPackets += format.packetCount() - receivedCount;
+  }
+  isReceived.assign(isReceived.size(), false);
+  receivedCount = 0;
+  lastPacket = -1;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixWireFormat.h"
+
+/// Stand-in for the building: listens for MUEB datagrams on a UDP port and
+/// reassembles them into frames.
+///
+/// Datagrams carry no frame number, so a frame is considered over as soon as
+/// a packet number repeats or goes backwards. Frames missing packets at that
+/// point are counted as incomplete and dropped.
+class MatrixMuebReceiver {
+ public:
+  struct Stats {
+    uint64_t datagrams;
+    uint64_t bytes;
+    uint64_t frames;            // complete frames handed to FrameReceived
+    uint64_t incompleteFrames;  // frames abandoned with packets missing
+    uint64_t lostPackets;       // packets missing from those frames
+    uint64_t malformed;         // datagrams not matching the wire format
+  };
+
+  MatrixMuebReceiver(const MatrixWireFormat& format);
+  ~MatrixMuebReceiver();
+
+  /// Bind to format.port on address, the loopback interface by default.
+  bool start(const std::string& address = "127.0.0.1");
+  void stop();
+
+  Stats getStats() const;
+
+  // --- Called from the receiver thread for every complete frame --- //
+  // arrival is the system clock time the frame's last datagram came in
+  std::function<void(const QImage& frame, MatrixClock::time_point arrival)>
+      FrameReceived;
+
+ private:
+  void receiverThreadFunc();
+  void receive(const uint8_t* data, size_t size);
+  void abandonFrame();
+
+  MatrixWireFormat format;
+  int socketFd;
+  int wakePipe[2];
+  std::thread receiverThread;
+  std::atomic_bool running;
+
+  // reassembly state, only touched by the receiver thread
+  QImage frame;
+  std::vector<bool> isReceived;
+  int receivedCount;
+  int lastPacket;
+
+  std::atomic<uint64_t> datagrams;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> frames;
+  std::atomic<uint64_t> incompleteFrames;
+  std::atomic<uint64_t> lostPackets;
+  std::atomic<uint64_t> malformed;
+};
@@ -0,0 +1,425 @@
+#include "MatrixNodeSync.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+static const uint8_t Magic[4] = {'M', 'X', 'N', 'S'};
+enum eMessage : uint8_t {
+  PING = 1,
+  PONG = 2,
+  STATE = 3,
+};
+
+// leader: how often the state goes out unchanged, and how often it checks
+// the player for changes that go out right away
+static const milliseconds StateInterval(250);
+static const milliseconds ChangePollInterval(10);
+static const seconds FollowerTimeout(5);
+// follower
+static const milliseconds PingInterval(100);
+static const size_t SampleCount = 8;
+// further off than this the follower jumps, closer it leaves the frame
+// timing alone
+static const microseconds AlignTolerance(200);
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void putInt(vector<uint8_t>& message, int64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    message.push_back(uint8_t(uint64_t(value) >> shift));
+  }
+}
+
+static int64_t getInt(const uint8_t* data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value = value << 8 | data[i];
+  }
+  return int64_t(value);
+}
+
+static vector<uint8_t> makeMessage(eMessage type) {
+  vector<uint8_t> message(Magic, Magic + 4);
+  message.push_back(type);
+  return message;
+}
+
+static int64_t toWire(MatrixClock::time_point time) {
+  return duration_cast<nanoseconds>(time.time_since_epoch()).count();
+}
+
+static MatrixClock::time_point fromWire(int64_t time) {
+  return MatrixClock::time_point(
+      duration_cast<MatrixClock::duration>(nanoseconds(time)));
+}
+
+MatrixNodeSync::MatrixNodeSync(MatrixPlayer& player, MatrixClock& localClock)
+    : player(player), followerClock(localClock) {
+  previousClock = nullptr;
+  socketFd = -1;
+  wakePipe[0] = wakePipe[1] = -1;
+  running = false;
+  isLeader = false;
+  leaderAddress = 0;
+  leaderPort = 0;
+  hasOffset = false;
+  hasTrack = false;
+  stats = Stats();
+}
+
+MatrixNodeSync::~MatrixNodeSync() { stop(); }
+
+bool MatrixNodeSync::startLeader(uint16_t port, const std::string& address) {
+  stop();
+  if (!openSocket(port, address)) {
+    return false;
+  }
+  isLeader = true;
+  followers.clear();
+  running = true;
+  syncThread = thread([this] { leaderThreadFunc(); });
+  return true;
+}
+
+bool MatrixNodeSync::startFollower(const std::string& leaderAddress,
+                                   uint16_t port) {
+  stop();
+  in_addr leader;
+  if (inet_pton(AF_INET, leaderAddress.c_str(), &leader) != 1) {
+    cout << "Invalid leader address " << leaderAddress << endl;
+    return false;
+  }
+  // any local port, the leader answers wherever the pings come from
+  if (!openSocket(0, "0.0.0.0")) {
+    return false;
+  }
+  isLeader = false;
+  this->leaderAddress = leader.s_addr;
+  leaderPort = htons(port);
+  samples.clear();
+  hasOffset = false;
+  hasTrack = false;
+  trackName.clear();
+
+  previousClock = player.getClock();
+  player.setClock(&followerClock);
+  running = true;
+  syncThread = thread([this] { followerThreadFunc(); });
+  return true;
+}
+
+void MatrixNodeSync::stop() {
+  if (!syncThread.joinable()) {
+    return;
+  }
+
+  running = false;
+  char byte = 0;
+  ssize_t written = write(wakePipe[1], &byte, 1);
+  (void)written;
+  syncThread.join();
+
+  close(socketFd);
+  close(wakePipe[0]);
+  close(wakePipe[1]);
+  socketFd = wakePipe[0] = wakePipe[1] = -1;
+
+  if (!isLeader && previousClock) {
+    player.stop();
+    player.setClock(previousClock);
+    previousClock = nullptr;
+  }
+}
+
+auto MatrixNodeSync::getStats() const -> Stats {
+  lock_guard<mutex> lk(statsMutex);
+  return stats;
+}
+
+bool MatrixNodeSync::openSocket(uint16_t port, const std::string& address) {
+  sockaddr_in bindAddress;
+  memset(&bindAddress, 0, sizeof(bindAddress));
+  bindAddress.sin_family = AF_INET;
+  bindAddress.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &bindAddress.sin_addr) != 1) {
+    cout << "Invalid sync address " << address << endl;
+    return false;
+  }
+
+  socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socketFd < 0) {
+    cout << "Failed to create sync socket: " << strerror(errno) << endl;
+    return false;
+  }
+  setNonBlocking(socketFd);
+  int reuse = 1;
+  setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if (::bind(socketFd, (sockaddr*)&bindAddress, sizeof(bindAddress)) < 0) {
+    cout << "Failed to bind sync socket to " << address << ":" << port << ": "
+         << strerror(errno) << endl;
+    close(socketFd);
+    socketFd = -1;
+    return false;
+  }
+
+  if (pipe(wakePipe) < 0) {
+    close(socketFd);
+    socketFd = -1;
+    return false;
+  }
+  setNonBlocking(wakePipe[0]);
+  setNonBlocking(wakePipe[1]);
+  return true;
+}
+
+void MatrixNodeSync::sendTo(const std::vector<uint8_t>& message,
+                            uint32_t address, uint16_t port) {
+  sockaddr_in target;
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = port;
+  target.sin_addr.s_addr = address;
+  sendto(socketFd, message.data(), message.size(), 0, (sockaddr*)&target,
+         sizeof(target));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Leader
+
+void MatrixNodeSync::leaderThreadFunc() {
+  vector<uint8_t> buffer(2048);
+  MatrixPlayer::eState sentState = MatrixPlayer::EMPTY;
+  MatrixClock::time_point sentOrigin;
+  string sentTrack;
+  auto nextState = steady_clock::now();
+
+  while (running) {
+    pollfd fds[2] = {{wakePipe[0], POLLIN, 0}, {socketFd, POLLIN, 0}};
+    if (poll(fds, 2, int(ChangePollInterval.count())) < 0 && errno != EINTR) {
+      cout << "Sync poll failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    sockaddr_in source;
+    socklen_t sourceSize = sizeof(source);
+    ssize_t received;
+    while ((received = recvfrom(socketFd, buffer.data(), buffer.size(), 0,
+                                (sockaddr*)&source, &sourceSize)) >= 0) {
+      receiveLeader(buffer.data(), received, source.sin_addr.s_addr,
+                    source.sin_port);
+      sourceSize = sizeof(source);
+    }
+
+    // seeks, pauses and track changes go out right away
+    auto snapshot = player.getSnapshot();
+    auto state = MatrixPlayer::eState(snapshot.state);
+    auto origin = snapshot.origin;
+    string track = player.getTrackName();
+    auto originMoved = origin - sentOrigin;
+    bool isSeeked = originMoved > AlignTolerance / 2 ||
+                    originMoved < -AlignTolerance / 2;
+    bool isChanged = state != sentState || track != sentTrack ||
+                     (state == MatrixPlayer::PLAYING && isSeeked);
+    if (isChanged || steady_clock::now() >= nextState) {
+      sendState();
+      sentState = state;
+      sentOrigin = origin;
+      sentTrack = track;
+      nextState = steady_clock::now() + StateInterval;
+    }
+  }
+}
+
+void MatrixNodeSync::receiveLeader(const uint8_t* data, size_t size,
+                                   uint32_t address, uint16_t port) {
+  auto received = player.getClock()->now();
+  if (size != 13 || memcmp(data, Magic, 4) != 0 || data[4] != PING) {
+    return;
+  }
+
+  auto follower = find_if(followers.begin(), followers.end(),
+                          [&](const Follower& follower) {
+                            return follower.address == address &&
+                                   follower.port == port;
+                          });
+  if (follower == followers.end()) {
+    followers.push_back({address, port, received});
+  } else {
+    follower->lastSeen = received;
+  }
+
+  vector<uint8_t> pong = makeMessage(PONG);
+  pong.insert(pong.end(), data + 5, data + 13);  // t1 as it came
+  putInt(pong, toWire(received));
+  putInt(pong, toWire(player.getClock()->now()));
+  sendTo(pong, address, port);
+}
+
+void MatrixNodeSync::sendState() {
+  auto now = player.getClock()->now();
+  followers.erase(remove_if(followers.begin(), followers.end(),
+                            [&](const Follower& follower) {
+                              return now - follower.lastSeen > FollowerTimeout;
+                            }),
+                  followers.end());
+  {
+    lock_guard<mutex> lk(statsMutex);
+    stats.followers = followers.size();
+  }
+  if (followers.empty()) {
+    return;
+  }
+
+  auto snapshot = player.getSnapshot();
+  string track = player.getTrackName().substr(0, 255);
+  vector<uint8_t> message = makeMessage(STATE);
+  message.push_back(uint8_t(snapshot.state));
+  putInt(message, toWire(snapshot.origin));
+  putInt(message, snapshot.positionAt(now).count());
+  message.push_back(uint8_t(track.size()));
+  message.insert(message.end(), track.begin(), track.end());
+
+  for (auto& follower : followers) {
+    sendTo(message, follower.address, follower.port);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Follower
+
+void MatrixNodeSync::followerThreadFunc() {
+  vector<uint8_t> buffer(2048);
+  MatrixClock& localClock = followerClock.getBase();
+  auto nextPing = steady_clock::now();
+
+  while (running) {
+    if (steady_clock::now() >= nextPing) {
+      vector<uint8_t> ping = makeMessage(PING);
+      putInt(ping, toWire(localClock.now()));
+      sendTo(ping, leaderAddress, leaderPort);
+      nextPing = steady_clock::now() + PingInterval;
+    }
+
+    auto timeout = duration_cast<milliseconds>(nextPing - steady_clock::now());
+    pollfd fds[2] = {{wakePipe[0], POLLIN, 0}, {socketFd, POLLIN, 0}};
+    if (poll(fds, 2, max(int(timeout.count()), 0) + 1) < 0 &&
+        errno != EINTR) {
+      cout << "Sync poll failed: " << strerror(errno) << endl;
+      break;
+    }
+
+    ssize_t received;
+    while ((received = recv(socketFd, buffer.data(), buffer.size(), 0)) >= 0) {
+      receiveFollower(buffer.data(), received);
+    }
+  }
+}
+
+void MatrixNodeSync::receiveFollower(const uint8_t* data, size_t size) {
+  auto t4 = followerClock.getBase().now();
+  if (size < 5 || memcmp(data, Magic, 4) != 0) {
+    return;
+  }
+
+  if (data[4] == PONG && size == 29) {
+    auto t1 = fromWire(getInt(data + 5));
+    auto t2 = fromWire(getInt(data + 13));
+    auto t3 = fromWire(getInt(data + 21));
+    Sample sample;
+    sample.offset = duration_cast<nanoseconds>(((t2 - t1) + (t3 - t4)) / 2);
+    sample.delay = duration_cast<nanoseconds>((t4 - t1) - (t3 - t2));
+    if (sample.delay < nanoseconds(0)) {
+      return;
+    }
+    samples.push_back(sample);
+    if (samples.size() > SampleCount) {
+      samples.erase(samples.begin());
+    }
+
+    // queueing only ever adds delay, the quickest round trip is the most
+    // symmetric one
+    auto best = *min_element(samples.begin(), samples.end(),
+                             [](const Sample& a, const Sample& b) {
+                               return a.delay < b.delay;
+                             });
+    // jump straight to the first estimates, slew once the filter is full
+    bool isAcquiring = samples.size() < SampleCount;
+    followerClock.setTargetOffset(best.offset, isAcquiring);
+    hasOffset = !isAcquiring;
+
+    lock_guard<mutex> lk(statsMutex);
+    stats.offset = best.offset;
+    stats.delay = best.delay;
+    stats.samples++;
+  } else if (data[4] == STATE && size >= 23 && size == 23u + data[22]) {
+    applyState(MatrixPlayer::eState(data[5]), fromWire(getInt(data + 6)),
+               microseconds(getInt(data + 14)),
+               string((const char*)data + 23, data[22]));
+  }
+}
+
+void MatrixNodeSync::applyState(MatrixPlayer::eState state,
+                                MatrixClock::time_point origin,
+                                std::chrono::microseconds position,
+                                const std::string& trackName) {
+  if (!hasTrack || trackName != this->trackName) {
+    hasTrack = true;
+    this->trackName = trackName;
+    if (trackName.empty()) {
+      player.clear();
+    } else if (LoadTrack && !LoadTrack(trackName)) {
+      cout << "Could not load " << trackName << " the leader plays" << endl;
+    }
+  }
+  if (!hasOffset) {
+    return;  // the origin means nothing yet
+  }
+
+  auto snapshot = player.getSnapshot();
+  auto current = MatrixPlayer::eState(snapshot.state);
+  if (current == MatrixPlayer::EMPTY) {
+    return;
+  }
+
+  bool isAligning = false;
+  if (state == MatrixPlayer::PLAYING) {
+    auto error = snapshot.origin - origin;
+    isAligning = current != MatrixPlayer::PLAYING || error > AlignTolerance ||
+                 error < -AlignTolerance;
+    if (isAligning) {
+      player.alignTimeline(origin);
+    }
+  } else if (state == MatrixPlayer::PAUSED) {
+    auto error = snapshot.positionAt(followerClock.now()) - position;
+    isAligning = current != MatrixPlayer::PAUSED ||
+                 error > MatrixPlayer::FrameTime / 2 ||
+                 error < -MatrixPlayer::FrameTime / 2;
+    if (isAligning) {
+      player.setTime(position);
+      player.pause();
+    }
+  } else if (current != MatrixPlayer::STOPPED) {
+    player.stop();
+  }
+
+  if (isAligning) {
+    lock_guard<mutex> lk(statsMutex);
+    stats.alignments++;
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixPlayer.h"
+
+/// Keeps the players of several machines showing the same frame, for
+/// facades split across player PCs.
+///
+/// One leader plays as usual and distributes its track, state and timeline
+/// origin (the leader clock time its media time 0 falls on) over UDP.
+/// Followers estimate the offset of the leader's clock from ping round
+/// trips the way NTP does: of the last few samples the one with the
+/// shortest round trip wins, its offset is assumed symmetric. They run
+/// their player on a MatrixDisciplinedClock steered to that offset and
+/// align their timeline to the leader's origin, so every node presents
+/// frame k at the same instant.
+///
+/// All messages are single datagrams on one port:
+///   ping  "MXNS" 1 t1
+///   pong  "MXNS" 2 t1 t2 t3
+///   state "MXNS" 3 state origin position name-length name
+/// with times as 64 bit big endian nanoseconds of the sender's clock,
+/// position in microseconds and state an eState.
+class MatrixNodeSync {
+ public:
+  static const uint16_t DefaultPort = 10100;
+
+  struct Stats {
+    std::chrono::nanoseconds offset;  // leader minus local clock, filtered
+    std::chrono::nanoseconds delay;   // round trip of the sample it is from
+    uint64_t samples;     // pongs received
+    uint64_t alignments;  // timeline realignments
+    size_t followers;     // followers heard from recently, leader only
+  };
+
+  /// localClock is what a follower's own time is read from, the system
+  /// clock unless testing.
+  MatrixNodeSync(MatrixPlayer& player,
+                 MatrixClock& localClock = MatrixClock::system());
+  ~MatrixNodeSync();
+
+  /// Serve followers on port of address.
+  bool startLeader(uint16_t port = DefaultPort,
+                   const std::string& address = "0.0.0.0");
+  /// Follow the leader at address. Sets the player's clock, which must
+  /// therefore be stopped and keeps the disciplined clock until stop().
+  bool startFollower(const std::string& leaderAddress,
+                     uint16_t port = DefaultPort);
+  void stop();
+  bool isRunning() const { return running; }
+
+  Stats getStats() const;
+
+  // --- Follower, called on the sync thread --- //
+  // load the track the leader plays, by the name MatrixPlayer::getTrackName
+  // gives on the leader
+  std::function<bool(const std::string& trackName)> LoadTrack;
+
+ private:
+  struct Follower {
+    uint32_t address;  // IPv4, network byte order
+    uint16_t port;     // network byte order
+    MatrixClock::time_point lastSeen;
+  };
+
+  struct Sample {
+    std::chrono::nanoseconds offset;
+    std::chrono::nanoseconds delay;
+  };
+
+  bool openSocket(uint16_t port, const std::string& address);
+  void leaderThreadFunc();
+  void followerThreadFunc();
+  void receiveLeader(const uint8_t* data, size_t size, uint32_t address,
+                     uint16_t port);
+  void receiveFollower(const uint8_t* data, size_t size);
+  void sendState();
+  void applyState(MatrixPlayer::eState state, MatrixClock::time_point origin,
+                  std::chrono::microseconds position,
+                  const std::string& trackName);
+  void sendTo(const std::vector<uint8_t>& message, uint32_t address,
+              uint16_t port);
+
+  MatrixPlayer& player;
+  MatrixDisciplinedClock followerClock;
+  MatrixClock* previousClock;
+
+  int socketFd;
+  int wakePipe[2];
+  std::thread syncThread;
+  std::atomic_bool running;
+  bool isLeader;
+
+  // leader, only touched by the sync thread
+  std::vector<Follower> followers;
+
+  // follower, only touched by the sync thread
+  uint32_t leaderAddress;
+  uint16_t leaderPort;
+  std::vector<Sample> samples;  // the last few, oldest first
+  bool hasOffset;
+  bool hasTrack;
+  std::string trackName;  // what the leader played last
+
+  mutable std::mutex statsMutex;
+  Stats stats;
+};
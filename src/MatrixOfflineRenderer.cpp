@@ -0,0 +1,221 @@
+#include "MatrixOfflineRenderer.h"
+
+#include <QDir>
+#include <QString>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "MatrixPlayer.h"
+#include "Q4XLoader.h"
+
+using namespace std;
+using namespace std::chrono;
+
+MatrixOfflineRenderer::MatrixOfflineRenderer() {
+  threadCount = 0;
+  compositor = nullptr;
+  filterChain = nullptr;
+  frameCount = 0;
+  duration = microseconds(0);
+}
+
+bool MatrixOfflineRenderer::parseFormat(const std::string& name,
+                                        eFormat& format) {
+  if (name == "none") {
+    format = NONE;
+  } else if (name == "raw") {
+    format = RAW;
+  } else if (name == "png") {
+    format = PNG;
+  } else if (name == "y4m") {
+    format = Y4M;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool MatrixOfflineRenderer::render(const std::string& filePath,
+                                   const std::string& outputPath,
+                                   eFormat format) {
+  frameCount = 0;
+  duration = microseconds(0);
+
+  // same timeline as MatrixPlayer::load
+  Q4XLoader loader;
+  if (!loader.load(filePath)) {
+    return false;
+  }
+  loader.resample(MatrixPlayer::FrameTime);
+
+  const vector<QImage>& frames = loader.getFrames();
+  microseconds frameTime = loader.getFrameTime();
+  for (auto& frame : frames) {
+    if (frame.width() != frames[0].width() ||
+        frame.height() != frames[0].height()) {
+      cout << "Frame dimensions differ within " << filePath << endl;
+      return false;
+    }
+  }
+
+  frameCount = frames.size();
+  duration = frameTime * (intptr_t)frameCount;
+  if (compositor) {
+    compositor->setSize(frames[0].width(), frames[0].height());
+  }
+  if (filterChain) {
+    filterChain->setSize(frames[0].width(), frames[0].height());
+  }
+
+  if (!presentAll(frames, frameTime, outputPath, format)) {
+    return false;
+  }
+  if (format != NONE) {
+    return writeTimestamps(outputPath + ".timestamps", frameTime);
+  }
+  return true;
+}
+
+bool MatrixOfflineRenderer::writeTimestamps(
+    const std::string& filePath, std::chrono::microseconds frameTime) {
+  ofstream outputFile(filePath, ios::trunc);
+  for (size_t i = 0; i < frameCount; i++) {
+    outputFile << i << " " << (frameTime * (intptr_t)i).count() << "\n";
+  }
+  return bool(outputFile);
+}
+
+// packed RGB888 without the scanline padding QImage may carry
+static void packRgb(const QImage& frame, vector<uint8_t>& output) {
+  size_t rowSize = 3 * frame.width();
+  output.resize(rowSize * frame.height());
+  for (int y = 0; y < frame.height(); y++) {
+    memcpy(&output[y * rowSize], frame.constScanLine(y), rowSize);
+  }
+}
+
+// BT.601 limited range, planar 4:4:4 behind the y4m frame marker
+static void packYuv(const QImage& frame, vector<uint8_t>& output) {
+  static const char marker[] = "FRAME\n";
+  size_t planeSize = size_t(frame.width()) * frame.height();
+  output.resize(sizeof(marker) - 1 + 3 * planeSize);
+  memcpy(output.data(), marker, sizeof(marker) - 1);
+
+  uint8_t* yPlane = &output[sizeof(marker) - 1];
+  uint8_t* uPlane = yPlane + planeSize;
+  uint8_t* vPlane = uPlane + planeSize;
+  for (int y = 0; y < frame.height(); y++) {
+    const uint8_t* line = frame.constScanLine(y);
+    for (int x = 0; x < frame.width(); x++) {
+      int r = line[3 * x + 0], g = line[3 * x + 1], b = line[3 * x + 2];
+      size_t i = size_t(y) * frame.width() + x;
+      yPlane[i] = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+      uPlane[i] = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+      vPlane[i] = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+  }
+}
+
+bool MatrixOfflineRenderer::presentAll(const std::vector<QImage>& frames,
+                                       std::chrono::microseconds frameTime,
+                                       const std::string& outputPath,
+                                       eFormat format) {
+  int width = frames[0].width(), height = frames[0].height();
+
+  // fixed size records let every worker write its frames in place
+  string filePath, header;
+  size_t recordSize = 0;
+  if (format == RAW) {
+    filePath = outputPath + ".rgb";
+    recordSize = 3 * size_t(width) * height;
+  } else if (format == Y4M) {
+    filePath = outputPath + ".y4m";
+    recordSize = 6 + 3 * size_t(width) * height;
+    header = "YUV4MPEG2 W" + to_string(width) + " H" + to_string(height) +
+             " F1000000:" + to_string(frameTime.count()) + " Ip A1:1 C444\n";
+  } else if (format == PNG) {
+    if (!QDir().mkpath(QString::fromStdString(outputPath))) {
+      cout << "Could not create " << outputPath << endl;
+      return false;
+    }
+  }
+
+  if (!filePath.empty()) {
+    ofstream outputFile(filePath, ios::binary | ios::trunc);
+    outputFile << header;
+    outputFile.seekp(header.size() + recordSize * frames.size() - 1);
+    outputFile.put('\0');
+    if (!outputFile) {
+      cout << "Could not create " << filePath << endl;
+      return false;
+    }
+  }
+
+  unsigned numThreads =
+      max(1u, threadCount ? threadCount : thread::hardware_concurrency());
+
+  atomic<size_t> nextFrame(0);
+  atomic_bool failed(false);
+  auto worker = [&] {
+    fstream outputFile;
+    if (!filePath.empty()) {
+      outputFile.open(filePath, ios::binary | ios::in | ios::out);
+    }
+    vector<uint8_t> buffer;
+
+    size_t index;
+    while (!failed && (index = nextFrame++) < frames.size()) {
+      QImage frame = frames[index].format() == QImage::Format_RGB888
+                         ? frames[index]
+                         : frames[index].convertToFormat(QImage::Format_RGB888);
+      // both stages serialize the workers, their results stay valid as
+      // the ring images detach while still held here
+      if (compositor && compositor->isActive()) {
+        frame = compositor->composite(frame);
+      }
+      if (filterChain && filterChain->isActive()) {
+        frame = filterChain->apply(frame);
+      }
+      if (PresentFrame) {
+        PresentFrame(index, frameTime * (intptr_t)index, frame);
+      }
+
+      bool isWritten = true;
+      if (format == RAW || format == Y4M) {
+        if (format == RAW) {
+          packRgb(frame, buffer);
+        } else {
+          packYuv(frame, buffer);
+        }
+        outputFile.seekp(header.size() + recordSize * index);
+        outputFile.write((const char*)buffer.data(), buffer.size());
+        isWritten = bool(outputFile);
+      } else if (format == PNG) {
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "/frame_%06zu.png", index);
+        isWritten =
+            frame.save(QString::fromStdString(outputPath + fileName), "PNG");
+      }
+
+      if (!isWritten) {
+        cout << "Writing frame " << index << " failed." << endl;
+        failed = true;
+      }
+    }
+  };
+
+  vector<thread> workers;
+  for (unsigned i = 1; i < numThreads; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  return !failed;
+}
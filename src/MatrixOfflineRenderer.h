@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QImage>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "MatrixCompositor.h"
+#include "MatrixFilterChain.h"
+
+/// Runs a q4x file through the same load and resample pipeline as
+/// MatrixPlayer, but as fast as possible instead of in real time.
+///
+/// Frames are presented to a sink that writes them to disk, or nowhere when
+/// only validating. Frames are independent once decoded, so conversion and
+/// writing are spread over several threads.
+class MatrixOfflineRenderer {
+ public:
+  enum eFormat {
+    NONE,  // decode and present only, for validation
+    RAW,   // <output>.rgb with packed RGB888 frames
+    PNG,   // <output>/frame_000000.png ...
+    Y4M,   // <output>.y4m, 4:4:4 YUV
+  };
+
+  MatrixOfflineRenderer();
+
+  /// Number of worker threads, 0 means one per hardware thread.
+  void setThreadCount(unsigned count) { threadCount = count; }
+
+  /// Stages every frame goes through before it is presented, as on its way
+  /// to the outputs of a player. Either may be null, both are sized to each
+  /// rendered track.
+  void setCompositor(MatrixCompositor* compositor) {
+    this->compositor = compositor;
+  }
+  void setFilterChain(MatrixFilterChain* filterChain) {
+    this->filterChain = filterChain;
+  }
+
+  /// Render filePath to outputPath. Every format except NONE also writes a
+  /// "<index> <timestamp us>" line per frame to <outputPath>.timestamps.
+  bool render(const std::string& filePath, const std::string& outputPath,
+              eFormat format);
+
+  size_t getFrameCount() const { return frameCount; }
+  std::chrono::microseconds getDuration() const { return duration; }
+
+  static bool parseFormat(const std::string& name, eFormat& format);
+
+  // --- Optional extra sink, called from the worker threads --- //
+  std::function<void(size_t index, std::chrono::microseconds time,
+                     const QImage& frame)>
+      PresentFrame;
+
+ private:
+  bool writeTimestamps(const std::string& filePath,
+                       std::chrono::microseconds frameTime);
+  bool presentAll(const std::vector<QImage>& frames,
+                  std::chrono::microseconds frameTime,
+                  const std::string& outputPath, eFormat format);
+
+  unsigned threadCount;
+  MatrixCompositor* compositor;
+  MatrixFilterChain* filterChain;
+  size_t frameCount;
+  std::chrono::microseconds duration;
+};
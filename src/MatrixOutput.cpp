@@ -0,0 +1,92 @@
+#include "MatrixOutput.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// libmueb transmitter
+
+MatrixTransmitterOutput::MatrixTransmitterOutput()
+    : transmitter(libmueb::MuebTransmitter::Instance()) {}
+
+int MatrixTransmitterOutput::width() const { return transmitter.width(); }
+
+int MatrixTransmitterOutput::height() const { return transmitter.height(); }
+
+void MatrixTransmitterOutput::send(size_t index, const QImage& frame) {
+  transmitter.SendFrame(frame);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-encoded UDP
+
+MatrixUdpOutput::MatrixUdpOutput(const MatrixWireFormat& format)
+    : format(format), sender(format) {
+  encodedFrameCount = 0;
+  stagedFrameCount = 0;
+  scratch.resize(format.frameSize());
+}
+
+void MatrixUdpOutput::stage(const std::vector<QImage>& frames) {
+  size_t frameSize = format.frameSize();
+  // replacing the vector frees a track staged before
+  stagedFrameCount = 0;
+  stagedFrames = vector<uint8_t>(frames.size() * frameSize);
+
+  // frames are independent, hand them out to one worker per core
+  atomic<size_t> nextFrame(0);
+  atomic_bool failed(false);
+  auto worker = [&] {
+    size_t index;
+    while (!failed && (index = nextFrame++) < frames.size()) {
+      if (!format.encode(frames[index], &stagedFrames[index * frameSize])) {
+        failed = true;
+      }
+    }
+  };
+
+  vector<thread> workers;
+  for (unsigned i = 1; i < thread::hardware_concurrency(); i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  if (failed) {
+    cout << "Could not pre-encode track for the UDP output." << endl;
+    stagedFrames = vector<uint8_t>();
+    return;
+  }
+  stagedFrameCount = frames.size();
+}
+
+void MatrixUdpOutput::commit() {
+  // a track that failed to encode is sent encoding on the spot
+  encodedFrames = std::move(stagedFrames);
+  encodedFrameCount = stagedFrameCount;
+  stagedFrames = vector<uint8_t>();
+  stagedFrameCount = 0;
+}
+
+void MatrixUdpOutput::clear() {
+  encodedFrameCount = 0;
+  encodedFrames.clear();
+  encodedFrames.shrink_to_fit();
+}
+
+void MatrixUdpOutput::send(size_t index, const QImage& frame) {
+  if (index < encodedFrameCount) {
+    sender.sendFrame(&encodedFrames[index * format.frameSize()]);
+    return;
+  }
+
+  // not part of the prepared track, encode on the spot
+  if (format.encode(frame, scratch.data())) {
+    sender.sendFrame(scratch.data());
+  }
+}
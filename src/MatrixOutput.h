@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QImage>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MatrixUdpSender.h"
+#include "MatrixWireFormat.h"
+#include "muebtransmitter.h"
+
+/// Where presented frames end up, e.g. a facade or a preview.
+///
+/// Outputs are driven by a MatrixOutputSink, which calls them from its own
+/// thread and hands them frames already mapped to width() x height().
+class MatrixOutput {
+ public:
+  /// Index of frames that are not part of the prepared track.
+  static const size_t NoIndex = SIZE_MAX;
+
+  virtual ~MatrixOutput() = default;
+
+  /// Frame size the output expects, 0 takes whatever it is given.
+  virtual int width() const = 0;
+  virtual int height() const = 0;
+
+  /// A new track is being loaded, frames are the mapped frames of the whole
+  /// timeline. Runs while the current track is still sent, so it only sets
+  /// up what commit() switches to. Staging no frames drops a staged track.
+  virtual void stage(const std::vector<QImage>& frames) {}
+  /// Switch over to the staged track. Never called while send() runs.
+  virtual void commit() {}
+  virtual void clear() {}
+
+  virtual void send(size_t index, const QImage& frame) = 0;
+};
+
+/// The libmueb transmitter, converting and packetizing on every send.
+class MatrixTransmitterOutput : public MatrixOutput {
+ public:
+  MatrixTransmitterOutput();
+
+  int width() const override;
+  int height() const override;
+  void send(size_t index, const QImage& frame) override;
+
+ private:
+  libmueb::MuebTransmitter& transmitter;
+};
+
+/// MUEB datagrams straight to an address, bypassing libmueb.
+///
+/// Tracks are encoded into ready-to-send datagrams once in stage(), spread
+/// over all cores, so sending a frame is a single send without conversion.
+/// Costs format.frameSize() bytes per frame, ~135 MB per hour at the default
+/// geometry.
+class MatrixUdpOutput : public MatrixOutput {
+ public:
+  MatrixUdpOutput(const MatrixWireFormat& format);
+
+  bool open(const std::string& address) { return sender.open(address); }
+
+  int width() const override { return format.width(); }
+  int height() const override { return format.height(); }
+  void stage(const std::vector<QImage>& frames) override;
+  void commit() override;
+  void clear() override;
+  void send(size_t index, const QImage& frame) override;
+
+ private:
+  MatrixWireFormat format;
+  MatrixUdpSender sender;
+  std::vector<uint8_t> encodedFrames;  // frameSize() bytes per frame
+  size_t encodedFrameCount;
+  std::vector<uint8_t> stagedFrames;  // the next track, same layout
+  size_t stagedFrameCount;
+  std::vector<uint8_t> scratch;  // for frames outside the track
+};
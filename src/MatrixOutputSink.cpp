@@ -0,0 +1,241 @@
+#include "MatrixOutputSink.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "MatrixTrace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+MatrixOutputSink::MatrixOutputSink(std::unique_ptr<MatrixOutput> output,
+                                   const MatrixOutputRegion& region)
+    : output(std::move(output)), region(region) {
+  keepaliveInterval = microseconds(1000 * 1000);
+  lastSentRun = SIZE_MAX;
+  lastSentGeneration = 0;
+  queueStart = queueSize = 0;
+  running = false;
+  isRealtimePending = false;
+}
+
+MatrixOutputSink::~MatrixOutputSink() { stop(); }
+
+void MatrixOutputSink::setKeepaliveInterval(
+    std::chrono::microseconds interval) {
+  keepaliveInterval = interval;
+}
+
+void MatrixOutputSink::setRealtimeOptions(
+    const MatrixRealtime::Options& options) {
+  {
+    lock_guard<mutex> lk(mtx);
+    realtimeOptions = options;
+    isRealtimePending = true;
+  }
+  cv.notify_all();
+}
+
+void MatrixOutputSink::stage(const std::vector<QImage>& frames) {
+  stagedFrames.clear();
+  for (auto& frame : frames) {
+    stagedFrames.push_back(map(frame));
+  }
+
+  // holds share the image, equal frames decoded twice compare by content
+  stagedRuns.resize(frames.size());
+  for (size_t i = 0; i < frames.size(); i++) {
+    bool isRepeat =
+        i > 0 && (frames[i].cacheKey() == frames[i - 1].cacheKey() ||
+                  frames[i] == frames[i - 1]);
+    stagedRuns[i] = isRepeat ? stagedRuns[i - 1] : i;
+  }
+
+  output->stage(stagedFrames);
+}
+
+void MatrixOutputSink::commit() {
+  stop();
+  frames.swap(stagedFrames);
+  frameRuns.swap(stagedRuns);
+  stagedFrames.clear();
+  stagedRuns.clear();
+  lastSentRun = SIZE_MAX;
+  lastSentGeneration = 0;
+  output->commit();
+  start();
+}
+
+void MatrixOutputSink::prepare(const std::vector<QImage>& frames) {
+  stage(frames);
+  commit();
+}
+
+void MatrixOutputSink::clear() {
+  stop();
+  output->clear();
+  frames.clear();
+  frameRuns.clear();
+  lastSentRun = SIZE_MAX;
+  lastSentGeneration = 0;
+}
+
+void MatrixOutputSink::present(size_t index) {
+  if (index < frames.size()) {
+    enqueue(index, QImage(), 0);
+  }
+}
+
+void MatrixOutputSink::present(size_t index, const QImage& frame) {
+  enqueue(index, frame, 0);
+}
+
+void MatrixOutputSink::present(size_t index, const QImage& frame,
+                               uint64_t generation) {
+  enqueue(index, frame, generation);
+}
+
+void MatrixOutputSink::enqueue(size_t index, const QImage& frame,
+                               uint64_t generation) {
+  {
+    lock_guard<mutex> lk(mtx);
+    if (!running) {
+      return;
+    }
+    if (queueSize == QueueCapacity) {
+      // the output fell behind, skip ahead rather than lag
+      queue[queueStart].frame = QImage();
+      queueStart = (queueStart + 1) % QueueCapacity;
+      queueSize--;
+      if (metrics) {
+        metrics->framesDropped++;
+      }
+    }
+    Entry& entry = queue[(queueStart + queueSize) % QueueCapacity];
+    entry.index = index;
+    entry.frame = frame;
+    entry.generation = generation;
+    queueSize++;
+  }
+  cv.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal stuff
+
+QImage MatrixOutputSink::map(const QImage& frame) const {
+  int x0 = region.x, y0 = region.y;
+  int regionWidth = region.width > 0 ? region.width : frame.width() - x0;
+  int regionHeight = region.height > 0 ? region.height : frame.height() - y0;
+  int width = output->width() > 0 ? output->width() : regionWidth;
+  int height = output->height() > 0 ? output->height() : regionHeight;
+
+  if (x0 == 0 && y0 == 0 && regionWidth == frame.width() &&
+      regionHeight == frame.height() && width == frame.width() &&
+      height == frame.height()) {
+    return frame;  // shared, no copy
+  }
+
+  const QImage& source = frame.format() == QImage::Format_RGB888
+                             ? frame
+                             : frame.convertToFormat(QImage::Format_RGB888);
+  QImage mapped(width, height, QImage::Format_RGB888);
+  mapped.fill(0);
+
+  // nearest neighbour, the matrix has no pixels to spare for filtering
+  for (int y = 0; y < height; y++) {
+    int sourceY = y0 + y * regionHeight / height;
+    if (sourceY < 0 || sourceY >= source.height()) {
+      continue;
+    }
+    const uint8_t* sourceLine = source.constScanLine(sourceY);
+    uint8_t* line = mapped.scanLine(y);
+    for (int x = 0; x < width; x++) {
+      int sourceX = x0 + x * regionWidth / width;
+      if (sourceX >= 0 && sourceX < source.width()) {
+        memcpy(&line[3 * x], &sourceLine[3 * sourceX], 3);
+      }
+    }
+  }
+  return mapped;
+}
+
+void MatrixOutputSink::start() {
+  lock_guard<mutex> lk(mtx);
+  queueStart = queueSize = 0;
+  running = true;
+  isRealtimePending = true;  // a new thread starts out normal
+  senderThread = thread([this] { senderThreadFunc(); });
+}
+
+void MatrixOutputSink::stop() {
+  {
+    lock_guard<mutex> lk(mtx);
+    running = false;
+  }
+  cv.notify_all();
+  if (senderThread.joinable()) {
+    senderThread.join();
+  }
+}
+
+void MatrixOutputSink::senderThreadFunc() {
+  MATRIX_TRACE_THREAD_NAME("output");
+  unique_lock<mutex> lk(mtx);
+  while (true) {
+    if (isRealtimePending) {
+      isRealtimePending = false;
+      MatrixRealtime::Options options = realtimeOptions;
+      lk.unlock();
+      MatrixRealtime::applyToCurrentThread(options, "output", false);
+      lk.lock();
+    }
+
+    cv.wait(lk, [this] {
+      return !running || queueSize > 0 || isRealtimePending;
+    });
+    if (!running) {
+      break;
+    }
+    if (queueSize == 0) {
+      continue;
+    }
+    size_t index = queue[queueStart].index;
+    QImage frame = queue[queueStart].frame;
+    uint64_t generation = queue[queueStart].generation;
+    queue[queueStart].frame = QImage();
+    queueStart = (queueStart + 1) % QueueCapacity;
+    queueSize--;
+    lk.unlock();
+
+    // a processed frame repeats as long as its run and generation do, a
+    // frame from elsewhere never
+    auto start = clock->now();
+    bool isTrackFrame = frame.isNull() || generation != 0;
+    size_t run = isTrackFrame && index < frameRuns.size() ? frameRuns[index]
+                                                          : SIZE_MAX;
+    if (run != SIZE_MAX && run == lastSentRun &&
+        generation == lastSentGeneration &&
+        start - lastSendTime < keepaliveInterval.load()) {
+      if (metrics) {
+        metrics->framesSkipped++;
+      }
+    } else {
+      MATRIX_TRACE_SCOPE("output", "send");
+      if (frame.isNull()) {
+        output->send(index, frames[index]);
+      } else {
+        output->send(MatrixOutput::NoIndex, map(frame));
+      }
+      lastSentRun = run;
+      lastSentGeneration = generation;
+      lastSendTime = start;
+      if (metrics) {
+        metrics->framesSent++;
+        metrics->sendDuration.record(clock->now() - start);
+      }
+    }
+
+    lk.lock();
+  }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixMetrics.h"
+#include "MatrixOutput.h"
+#include "MatrixRealtime.h"
+
+/// Part of the source frame an output shows. A width or height of 0 means
+/// the whole frame.
+struct MatrixOutputRegion {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+/// Runs one MatrixOutput on its own thread.
+///
+/// The reactor only queues the index of each presented frame, so a
+/// slow output never holds up the schedule or the other outputs. When an
+/// output falls behind, the oldest queued frames are dropped and it catches
+/// up with the rest instead of lagging, which keeps all outputs on the same
+/// frame.
+///
+/// On stage() the track is mapped to the output once: the region is cut
+/// out and scaled to the output's size, and runs of identical frames are
+/// found so unchanged frames are only resent at the keepalive interval.
+class MatrixOutputSink {
+ public:
+  MatrixOutputSink(std::unique_ptr<MatrixOutput> output,
+                   const MatrixOutputRegion& region);
+  ~MatrixOutputSink();
+
+  MatrixOutput& getOutput() { return *output; }
+
+  void setMetrics(MatrixMetrics* metrics) { this->metrics = metrics; }
+  void setClock(MatrixClock* clock) { this->clock = clock; }
+
+  /// Resend an unchanged frame only after interval, zero sends every frame.
+  void setKeepaliveInterval(std::chrono::microseconds interval);
+
+  /// Scheduling of the sender thread, applied right away and to every
+  /// sender thread started later. Failures are not reported.
+  void setRealtimeOptions(const MatrixRealtime::Options& options);
+
+  /// Map a new track and let the output get ready for it, while the current
+  /// one is still presented. One thread stages at a time, staging no frames
+  /// drops a staged track.
+  void stage(const std::vector<QImage>& frames);
+  /// Switch over to the staged track, must not race with present().
+  void commit();
+  /// Stage and commit at once.
+  void prepare(const std::vector<QImage>& frames);
+  void clear();
+
+  /// Queue frame index of the prepared track, called by the reactor.
+  void present(size_t index);
+  /// Queue a frame that is not part of the track, e.g. a live one.
+  void present(size_t index, const QImage& frame);
+  /// Queue track frame index as processed by the caller, e.g. composited.
+  /// Frames of the same run and generation are taken to be equal, so the
+  /// generation must change whenever the processing does.
+  void present(size_t index, const QImage& frame, uint64_t generation);
+
+ private:
+  static const size_t QueueCapacity = 4;
+
+  struct Entry {
+    size_t index;
+    QImage frame;  // null for the prepared track frame
+    uint64_t generation;  // of the processing, 0 if not a processed frame
+  };
+
+  void start();
+  void stop();
+  void enqueue(size_t index, const QImage& frame, uint64_t generation);
+  void senderThreadFunc();
+  QImage map(const QImage& frame) const;
+
+  std::unique_ptr<MatrixOutput> output;
+  MatrixOutputRegion region;
+  MatrixMetrics* metrics = nullptr;
+  MatrixClock* clock = &MatrixClock::system();
+  std::atomic<std::chrono::microseconds> keepaliveInterval;
+  MatrixRealtime::Options realtimeOptions;
+  bool isRealtimePending;  // options still to be applied by the sender
+
+  std::vector<QImage> frames;  // mapped to the output
+  std::vector<size_t> frameRuns;  // first frame of the run each frame is in
+  std::vector<QImage> stagedFrames;  // the next track, until commit()
+  std::vector<size_t> stagedRuns;
+  size_t lastSentRun;
+  uint64_t lastSentGeneration;
+  MatrixClock::time_point lastSendTime;
+
+  std::thread senderThread;
+  std::mutex mtx;
+  std::condition_variable cv;
+  Entry queue[QueueCapacity];
+  size_t queueStart;
+  size_t queueSize;
+  bool running;
+};
@@ -1,72 +1,258 @@
 #include "MatrixPlayer.h"
 
-#include <QDebug>
-#include <QElapsedTimer>
 #include <QImage>
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <exception>
 #include <iostream>
 
+#include "MatrixTrace.h"
 #include "Q4XLoader.h"
 
 using namespace std;
 using namespace std::chrono;
 
 MatrixPlayer::MatrixPlayer()
-    : transmitter(libmueb::MuebTransmitter::Instance()),
-      videoListener(*this),
-      audioListener(*this) {
+    : videoListener(*this),
+      audioListener(*this),
+      videoPlayer(&reactor),
+      audioPlayer(&reactor) {
   audioEndedFlag = videoEndedFlag = false;
+  listeners = make_shared<set<MatrixPlayerListener*>>();
+  synchronizerTimer = 0;
+  loadGeneration = 0;
+  setKeepaliveInterval(microseconds(1000 * 1000));
   videoPlayer.addListener(&videoListener);
   audioPlayer.addListener(&audioListener);
+  videoPlayer.setMetrics(&metrics);
+  addOutput(make_unique<MatrixTransmitterOutput>());
+
+  // set presentation method, called on the reactor, the outputs send on
+  // their own threads
+  videoPlayer.PresentFrame = [this](size_t index, const QImage& frame) {
+    bool isComposed = compositor.isActive();
+    bool isFiltered = filterChain.isActive();
+    if (isComposed || isFiltered) {
+      uint64_t layerGeneration = isComposed ? compositor.getGeneration() : 0;
+      uint64_t filterGeneration = isFiltered ? filterChain.getGeneration() : 0;
+      if (layerGeneration != processedLayerGeneration ||
+          filterGeneration != processedFilterGeneration) {
+        processedLayerGeneration = layerGeneration;
+        processedFilterGeneration = filterGeneration;
+        processedGeneration++;
+        processedSource = QImage();
+      }
 
-  // set presentation method
-  videoPlayer.PresentFrame = [this](const QImage& frame) {
-    //    QElapsedTimer timer;
-    //    timer.start();
+      // holds share their image, a run is only processed once
+      if (frame.cacheKey() != processedSource.cacheKey()) {
+        QImage processed = frame;
+        if (isComposed) {
+          auto start = clock->now();
+          processed = compositor.composite(processed);
+          metrics.composeDuration.record(clock->now() - start);
+        }
+        if (isFiltered) {
+          auto start = clock->now();
+          processed = filterChain.apply(processed);
+          metrics.filterDuration.record(clock->now() - start);
+        }
+        processedSource = frame;
+        processedFrame = processed;
+      }
 
-    transmitter.SendFrame(frame);
+      lock_guard<mutex> lk(outputMutex);
+      for (auto& output : outputs) {
+        if (liveSource) {
+          output->present(index, processedFrame);
+        } else {
+          output->present(index, processedFrame, processedGeneration);
+        }
+      }
+      return;
+    }
 
-    //    qDebug() << "The slow operation took" << timer.elapsed() <<
-    //    "milliseconds"
-    //             << timer.nsecsElapsed() << "nano";
+    lock_guard<mutex> lk(outputMutex);
+    for (auto& output : outputs) {
+      if (liveSource) {
+        output->present(index, frame);  // not part of any prepared track
+      } else {
+        output->present(index);
+      }
+    }
   };
 }
 
-MatrixPlayer::~MatrixPlayer() { stopSynchronizer(); }
+MatrixPlayer::~MatrixPlayer() {
+  loadGeneration++;
+  {
+    lock_guard<mutex> lk(loaderMutex);
+    if (loaderThread.joinable()) {
+      loaderThread.join();
+    }
+  }
+  stopSynchronizer();
+}
 
 // --- Playback control --- //
 void MatrixPlayer::play() {
+  lock_guard<recursive_mutex> lk(controlMutex);
   if (videoEndedFlag || audioEndedFlag) {
     videoPlayer.stop();
     audioPlayer.stop();
   }
 
-  videoPlayer.play();
-  audioPlayer.play();
-
+  startPlayers();
   startSynchronizer();
 }
 
+void MatrixPlayer::alignTimeline(MatrixClock::time_point origin) {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  if (videoPlayer.getState() != MatrixVideoPlayer::PLAYING) {
+    play();
+  }
+  videoPlayer.alignTimeline(origin);
+  auto now = clock->now();
+  if (hasAudio && now > origin) {
+    audioPlayer.setTime(now - origin);
+  }
+}
+
+void MatrixPlayer::beginScrub() {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  auto state = videoPlayer.getState();
+  if (state != MatrixVideoPlayer::PLAYING &&
+      state != MatrixVideoPlayer::PAUSED) {
+    return;
+  }
+  isResumedAfterScrub = state == MatrixVideoPlayer::PLAYING;
+  pause();
+  videoPlayer.beginScrub();
+}
+
+void MatrixPlayer::endScrub() {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  if (!videoPlayer.isScrubbing()) {
+    return;
+  }
+  videoPlayer.endScrub();
+  audioPlayer.setTime(videoPlayer.getTime());
+  if (isResumedAfterScrub) {
+    play();
+  }
+}
+
 void MatrixPlayer::pause() {
+  lock_guard<recursive_mutex> lk(controlMutex);
   stopSynchronizer();
   videoPlayer.pause();
   audioPlayer.pause();
 }
 
 void MatrixPlayer::stop() {
+  lock_guard<recursive_mutex> lk(controlMutex);
   stopSynchronizer();
   audioEndedFlag = videoEndedFlag = false;
   videoPlayer.stop();
   audioPlayer.stop();
 }
 
+void MatrixPlayer::setClock(MatrixClock* clock) {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  this->clock = clock;
+  reactor.setClock(clock);
+  videoPlayer.setClock(clock);
+  audioPlayer.setClock(clock);
+  lock_guard<mutex> outputLock(outputMutex);
+  for (auto& output : outputs) {
+    output->setClock(clock);
+  }
+}
+
+MatrixOutputSink* MatrixPlayer::addOutput(
+    std::unique_ptr<MatrixOutput> output, const MatrixOutputRegion& region) {
+  auto sink = make_shared<MatrixOutputSink>(std::move(output), region);
+  sink->setMetrics(&metrics);
+  sink->setClock(clock);
+  sink->setKeepaliveInterval(keepaliveInterval);
+
+  lock_guard<recursive_mutex> lk(controlMutex);
+  sink->setRealtimeOptions(realtimeOptions);
+  if (!trackFrames.empty() || liveSource) {
+    sink->prepare(trackFrames);
+  }
+  lock_guard<mutex> outputLock(outputMutex);
+  outputs.push_back(std::move(sink));
+  return outputs.back().get();
+}
+
+void MatrixPlayer::removeOutput(MatrixOutputSink* output) {
+  shared_ptr<MatrixOutputSink> removed;
+  {
+    lock_guard<mutex> lk(outputMutex);
+    for (size_t i = 0; i < outputs.size(); i++) {
+      if (outputs[i].get() == output) {
+        removed = std::move(outputs[i]);
+        outputs.erase(outputs.begin() + i);
+        break;
+      }
+    }
+  }
+  // joins the output's thread, keep that outside the reactor's way
+}
+
+void MatrixPlayer::clearOutputs() {
+  vector<shared_ptr<MatrixOutputSink>> removed;
+  {
+    lock_guard<mutex> lk(outputMutex);
+    removed.swap(outputs);
+  }
+}
+
+void MatrixPlayer::setKeepaliveInterval(std::chrono::microseconds interval) {
+  // a sink skips a frame sent less than an interval ago, refreshing twice as
+  // often keeps jitter from skipping whole intervals while paused
+  videoPlayer.setPausedRefreshInterval(interval / 2);
+  lock_guard<mutex> lk(outputMutex);
+  keepaliveInterval = interval;
+  for (auto& output : outputs) {
+    output->setKeepaliveInterval(interval);
+  }
+}
+
+bool MatrixPlayer::setRealtimeOptions(const MatrixRealtime::Options& options) {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  realtimeOptions = options;
+  bool isMemoryLocked = MatrixRealtime::lockMemory(options);
+
+  bool isReactorApplied = true;
+  reactor.post([&] {
+    isReactorApplied = MatrixRealtime::applyToCurrentThread(options, "reactor");
+  });
+  reactor.flush();
+
+  {
+    lock_guard<mutex> outputLock(outputMutex);
+    for (auto& output : outputs) {
+      output->setRealtimeOptions(options);
+    }
+  }
+  if (options.isPrefaulting) {
+    MatrixRealtime::prefault(trackFrames);
+  }
+  return isMemoryLocked && isReactorApplied;
+}
+
 void MatrixPlayer::setVolume(float volume) {
   lock_guard<mutex> lk(subPlayerMutex);
   audioPlayer.setVolume(volume);
 }
 
+std::string MatrixPlayer::getTrackName() const {
+  lock_guard<mutex> lk(subPlayerMutex);
+  return trackName;
+}
+
 float MatrixPlayer::getVolume() const {
   lock_guard<mutex> lk(subPlayerMutex);
   return audioPlayer.getVolume();
@@ -74,126 +260,260 @@ float MatrixPlayer::getVolume() const {
 
 // --- Get state --- //
 MatrixPlayer::eState MatrixPlayer::getState() const {
-  lock_guard<mutex> lk(subPlayerMutex);
-  return (eState)videoPlayer.getState();
+  return (eState)videoPlayer.getSnapshot().state;
 }
 
 std::chrono::microseconds MatrixPlayer::getTime() const {
-  lock_guard<mutex> lk(subPlayerMutex);
-  return videoPlayer.getTime();
+  return videoPlayer.getSnapshot().positionAt(clock->now());
 }
 
 std::chrono::microseconds MatrixPlayer::getDuration() const {
-  lock_guard<mutex> lk(subPlayerMutex);
-  return videoPlayer.getDuration();
+  return videoPlayer.getSnapshot().duration;
 }
 
 // --- Input data --- //
-bool MatrixPlayer::load(const std::string& filePath) {
+bool MatrixPlayer::load(const std::string& filePath,
+                        const LoadProgress& progress) {
+  // loadTrack() only takes the control lock to switch over
   clear();
+  return loadTrack(filePath, loadGeneration, progress);
+}
+
+std::future<bool> MatrixPlayer::loadAsync(const std::string& filePath,
+                                          LoadProgress progress) {
+  uint64_t generation = ++loadGeneration;
+  auto promise = make_shared<std::promise<bool>>();
+  auto result = promise->get_future();
+
+  // the previous load sees the new generation and gives up at its next slice
+  lock_guard<mutex> lk(loaderMutex);
+  if (loaderThread.joinable()) {
+    loaderThread.join();
+  }
+  loaderThread = thread([this, filePath, generation, progress, promise] {
+    MATRIX_TRACE_THREAD_NAME("loader");
+    promise->set_value(loadTrack(filePath, generation, progress));
+  });
+  return result;
+}
 
+bool MatrixPlayer::loadTrack(const std::string& filePath, uint64_t generation,
+                             const LoadProgress& progress) {
+  // decode, open the sound and prepare the outputs without the control
+  // lock, the current track plays on meanwhile and clear() never waits
+  auto isCurrent = [&] { return loadGeneration == generation; };
   Q4XLoader loader;
-  bool isLoaded = loader.load(filePath);
-  bool isVideoOk = false;
+  bool isLoaded = loader.load(filePath, [&](float fraction) {
+    if (progress) {
+      progress(fraction * 0.9f);
+    }
+    return isCurrent();
+  });
+  if (!isLoaded) {
+    return false;
+  }
+  {
+    MATRIX_TRACE_SCOPE("load", "resample");
+    loader.resample(FrameTime);
+  }
+  const vector<QImage>& frames = loader.getFrames();
+
+  lock_guard<mutex> stagingLock(stagingMutex);
   bool isAudioOk = true;
+  bool hasSound = loader.getSoundData() != nullptr;
+  if (hasSound && isCurrent()) {
+    isAudioOk =
+        audioPlayer.stage(loader.getSoundData(), loader.getSoundDataSize());
+  }
 
-  if (!isLoaded) {
+  bool isPrefaulting;
+  vector<shared_ptr<MatrixOutputSink>> staged;
+  {
+    lock_guard<recursive_mutex> lk(controlMutex);
+    isPrefaulting = realtimeOptions.isPrefaulting;
+    lock_guard<mutex> outputLock(outputMutex);
+    staged = outputs;
+  }
+  if (isPrefaulting && isCurrent()) {
+    MatrixRealtime::prefault(frames);
+  }
+  {
+    MATRIX_TRACE_SCOPE("load", "stage outputs");
+    for (auto& output : staged) {
+      if (!isCurrent()) {
+        break;
+      }
+      output->stage(frames);
+    }
+  }
+
+  lock_guard<recursive_mutex> lk(controlMutex);
+  bool isVideoOk = false;
+  if (isCurrent()) {
+    clearTrack();
+    // getters may poll from other threads while this runs on the loader
+    lock_guard<mutex> subLock(subPlayerMutex);
+    isVideoOk = videoPlayer.load(frames.data(), frames.size(),
+                                 loader.getFrameTime());
+    trackName = filePath.substr(filePath.find_last_of("/\\") + 1);
+    hasAudio = hasSound;
+    if (hasSound && isAudioOk) {
+      isAudioOk = audioPlayer.commit();
+    }
+  }
+  if (!isVideoOk) {
+    // superseded while staging, or not playable
+    audioPlayer.discardStaged();
+    for (auto& output : staged) {
+      output->stage(vector<QImage>());
+    }
+    if (isCurrent()) {
+      clearTrack();
+    }
     return false;
   }
 
-  if (isLoaded) {
-    loader.resample(microseconds(1000 * 1000 / 30));
-    isVideoOk =
-        videoPlayer.load(loader.getFrames().data(), loader.getFrames().size(),
-                         loader.getFrameTime());
-    if (loader.getSoundData()) {
-      hasAudio = true;
-      isAudioOk =
-          audioPlayer.load(loader.getSoundData(), loader.getSoundDataSize());
-    } else {
-      hasAudio = false;
+  trackFrames = frames;
+  compositor.setSize(trackFrames[0].width(), trackFrames[0].height());
+  filterChain.setSize(trackFrames[0].width(), trackFrames[0].height());
+  {
+    lock_guard<mutex> outputLock(outputMutex);
+    for (auto& output : outputs) {
+      bool isStaged = find(staged.begin(), staged.end(), output) !=
+                      staged.end();
+      if (isStaged) {
+        output->commit();
+      } else {
+        output->prepare(trackFrames);  // added while staging
+      }
     }
   }
 
-  if (isAudioOk && isVideoOk) {
-    return true;
-  } else {
-    clear();
+  if (!isAudioOk) {
+    clearTrack();
     return false;
   }
+  if (progress) {
+    progress(1.0f);
+  }
+  return true;
+}
+
+bool MatrixPlayer::loadLive(std::unique_ptr<MatrixFrameSource> source,
+                            std::chrono::microseconds frameTime) {
+  lock_guard<recursive_mutex> lk(controlMutex);
+  clear();
+
+  {
+    lock_guard<mutex> subLock(subPlayerMutex);
+    if (!videoPlayer.loadLive(source.get(), frameTime)) {
+      return false;
+    }
+    hasAudio = false;
+    trackName = "live";
+  }
+  liveSource = std::move(source);
+  compositor.setSize(liveSource->width(), liveSource->height());
+  filterChain.setSize(liveSource->width(), liveSource->height());
+  // no track to map up front, the outputs map every frame as it comes
+  lock_guard<mutex> outputLock(outputMutex);
+  for (auto& output : outputs) {
+    output->prepare(trackFrames);
+  }
+  return true;
 }
 
 void MatrixPlayer::clear() {
+  // cancel first, a running load then gives up instead of being waited for
+  loadGeneration++;
+  clearTrack();
+}
+
+void MatrixPlayer::clearTrack() {
+  lock_guard<recursive_mutex> lk(controlMutex);
   stopSynchronizer();
   videoPlayer.clear();
   audioPlayer.clear();
   audioEndedFlag = videoEndedFlag = false;
+  trackFrames.clear();
+  liveSource.reset();
+  {
+    lock_guard<mutex> subLock(subPlayerMutex);
+    trackName.clear();
+  }
+  lock_guard<mutex> outputLock(outputMutex);
+  for (auto& output : outputs) {
+    output->clear();
+  }
 }
 
 void MatrixPlayer::addListener(MatrixPlayerListener* listener) {
-  listeners.insert(listener);
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto changed = make_shared<set<MatrixPlayerListener*>>(*listeners);
+  changed->insert(listener);
+  listeners = std::move(changed);
 }
 
 void MatrixPlayer::removeListener(MatrixPlayerListener* listener) {
-  listeners.erase(listener);
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto changed = make_shared<set<MatrixPlayerListener*>>(*listeners);
+  changed->erase(listener);
+  listeners = std::move(changed);
 }
 
 void MatrixPlayer::notifyListenersState(eState state) {
-  if (listeners.empty()) return;
-
-  for (auto listener : listeners) {
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto current = listeners;
+  for (auto listener : *current) {
     listener->onStateChanged(state);
   }
 }
 
 void MatrixPlayer::notifyListenersTime(double time) {
-  if (listeners.empty()) return;
-
-  for (auto listener : listeners) {
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto current = listeners;
+  for (auto listener : *current) {
     listener->onTimeChanged(time);
   }
 }
 
 void MatrixPlayer::notifyListenersTrackEnd() {
-  if (listeners.empty()) return;
-
-  for (auto listener : listeners) {
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto current = listeners;
+  for (auto listener : *current) {
     listener->onTrackEnded();
   }
 }
 
 void MatrixPlayer::notifyListenersFrame(const QImage& frame) {
-  if (listeners.empty()) return;
-
-  for (auto listener : listeners) {
+  lock_guard<recursive_mutex> lk(listenerMutex);
+  auto current = listeners;
+  for (auto listener : *current) {
     listener->onFrameChanged(frame);
   }
 }
 
+MatrixClock::time_point MatrixPlayer::startPlayers() {
+  auto start = clock->now() + StartLead;
+  videoPlayer.playAt(start);
+  audioPlayer.playAt(start);
+  return start;
+}
+
 void MatrixPlayer::startSynchronizer() {
   stopSynchronizer();
-  runSynchronizer = true;
-  synchronizerThread = thread([this] {
-    unsigned long long counter = 0;
-    while (runSynchronizer) {
-      if (counter % 20 == 0) {
-        if (hasAudio) {
-          lock_guard<mutex> lk(subPlayerMutex);
-          auto time = audioPlayer.getTime();
-          videoPlayer.syncToExternalSource(time);
-        }
-      }
-      counter++;
-      this_thread::sleep_for(milliseconds(50));
+  synchronizerTimer = reactor.schedulePeriodic(seconds(1), [this] {
+    if (hasAudio) {
+      lock_guard<mutex> lk(subPlayerMutex);
+      auto time = audioPlayer.getTime();
+      videoPlayer.syncToExternalSource(time);
     }
+    metrics.updateThreadCpu(MatrixMetrics::REACTOR_THREAD);
   });
 }
 
 void MatrixPlayer::stopSynchronizer() {
-  runSynchronizer = false;
-  if (synchronizerThread.joinable()) {
-    synchronizerThread.join();
-  }
+  reactor.cancel(synchronizerTimer.exchange(0));
 }
 
 void MatrixPlayer::VideoListener::onStateChanged(
@@ -210,7 +530,7 @@ void MatrixPlayer::VideoListener::onFrameChanged(const QImage& frame) {
 }
 
 void MatrixPlayer::VideoListener::onTrackEnded() {
-  parent.runSynchronizer = false;
+  parent.stopSynchronizer();
   if (parent.audioEndedFlag || !parent.hasAudio) {
     parent.notifyListenersTrackEnd();
     parent.audioEndedFlag = parent.videoEndedFlag = false;
@@ -222,7 +542,7 @@ void MatrixPlayer::VideoListener::onTrackEnded() {
 void MatrixPlayer::AudioListener::onStateChanged(MatrixAudioPlayer::eState) {}
 
 void MatrixPlayer::AudioListener::onTrackEnded() {
-  parent.runSynchronizer = false;
+  parent.stopSynchronizer();
   if (parent.videoEndedFlag) {
     parent.notifyListenersTrackEnd();
     parent.audioEndedFlag = parent.videoEndedFlag = false;
@@ -1,15 +1,24 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <set>
+#include <string>
 #include <thread>
 
 #include "MatrixAudioPlayer.h"
+#include "MatrixCompositor.h"
+#include "MatrixFilterChain.h"
+#include "MatrixFrameSource.h"
+#include "MatrixMetrics.h"
+#include "MatrixOutputSink.h"
+#include "MatrixReactor.h"
+#include "MatrixRealtime.h"
 #include "MatrixVideoPlayer.h"
-#include "muebtransmitter.h"
 
 class MatrixPlayerListener;
 
@@ -44,34 +53,113 @@ class MatrixPlayer {
     PLAYING,
   };
 
+  /// Every track is resampled to this frame time on load.
+  static constexpr std::chrono::microseconds FrameTime{1000 * 1000 / 30};
+
   MatrixPlayer();
   ~MatrixPlayer();
 
   // --- Playback control --- //
+  /// Video and audio start together at an instant slightly ahead, so a track
+  /// starts in sync instead of waiting for the synchronizer to pull it in.
   void play();
   void pause();
   void stop();
 
   template <class Rep, class Period>
   void setTime(std::chrono::duration<Rep, Period> time);
+  /// Play along a timeline that started at clock time origin, e.g. one
+  /// shared with other players, starting playback if needed. Video frames
+  /// land exactly on it, audio as close as seeking gets.
+  void alignTimeline(MatrixClock::time_point origin);
+
+  /// Scrub mode for finding cue points on the facade. Playback pauses with
+  /// the audio muted and the frame at the latest scrubTo() time reaches the
+  /// outputs and listeners within a frame, however fast the calls come.
+  /// endScrub() moves the audio there and resumes if it was playing before.
+  void beginScrub();
+  void scrubTo(std::chrono::microseconds time) { videoPlayer.scrubTo(time); }
+  void endScrub();
+  bool isScrubbing() const { return videoPlayer.isScrubbing(); }
 
   void setVolume(float volume);
 
   // --- Get state --- //
+  // lock-free, cheap enough to poll at any rate from any thread
   eState getState() const;
   std::chrono::microseconds getTime() const;
   std::chrono::microseconds getDuration() const;
+  /// State, time and duration as one consistent set, its state values are
+  /// those of eState.
+  MatrixVideoPlayer::Snapshot getSnapshot() const {
+    return videoPlayer.getSnapshot();
+  }
+
+  /// File name of the loaded track without its directory, "live" for a
+  /// live source and empty without a track.
+  std::string getTrackName() const;
 
   size_t width() const { return videoPlayer.width(); }
   size_t height() const { return videoPlayer.height(); }
 
   float getVolume() const;
 
+  /// Safe from any thread and from within a callback. Once removeListener()
+  /// returns, the listener is not called anymore.
   void addListener(MatrixPlayerListener*);
   void removeListener(MatrixPlayerListener*);
 
+  /// Time source of all playback timing, only change it while stopped.
+  void setClock(MatrixClock* clock);
+  MatrixClock* getClock() const { return clock; }
+
+  // --- Outputs --- //
+  /// Every presented frame is fanned out to all outputs, each running on its
+  /// own thread. A new player sends through the libmueb transmitter only.
+  MatrixOutputSink* addOutput(
+      std::unique_ptr<MatrixOutput> output,
+      const MatrixOutputRegion& region = MatrixOutputRegion());
+  void removeOutput(MatrixOutputSink* output);
+  void clearOutputs();
+
+  /// Frames identical to the one sent last are only sent again once interval
+  /// has passed, so holds, pauses and the blank tail of a track refresh the
+  /// panels at that rate instead of the frame rate. Zero sends every frame,
+  /// and nothing at all while paused.
+  void setKeepaliveInterval(std::chrono::microseconds interval);
+
+  /// Real time scheduling of the reactor and the output threads, memory
+  /// locking and prefaulting of loaded tracks. Returns false if anything
+  /// could not be applied, the reasons are printed and playback carries on
+  /// without it.
+  bool setRealtimeOptions(const MatrixRealtime::Options& options);
+
+  /// Overlay layers blended over every frame before it reaches the outputs.
+  MatrixCompositor& getCompositor() { return compositor; }
+  /// Dimmer, color balance and gamma of every frame after the overlays.
+  MatrixFilterChain& getFilterChain() { return filterChain; }
+
+  MatrixMetrics& getMetrics() { return metrics; }
+  const MatrixMetrics& getMetrics() const { return metrics; }
+
   // --- Input data --- //
-  bool load(const std::string& filePath);
+  /// Fraction of a load done so far, 0 to 1, called on the loading thread.
+  using LoadProgress = std::function<void(float progress)>;
+
+  bool load(const std::string& filePath,
+            const LoadProgress& progress = nullptr);
+  /// Load on a background thread. The current track is replaced only once
+  /// the new one is decoded. A later load(), loadAsync() or clear() cancels
+  /// it: decoding stops at its next slice, frees its memory and the future
+  /// yields false.
+  std::future<bool> loadAsync(const std::string& filePath,
+                              LoadProgress progress = nullptr);
+  /// Play frames made while playing instead of a track, e.g. by a renderer
+  /// writing into a MatrixSharedMemorySource. They go through the same
+  /// frame timing, compositor and outputs as a track, without audio, and a
+  /// new frame is taken every frameTime.
+  bool loadLive(std::unique_ptr<MatrixFrameSource> source,
+                std::chrono::microseconds frameTime = FrameTime);
   void clear();
 
  private:
@@ -79,31 +167,83 @@ class MatrixPlayer {
   void notifyListenersTime(double time);
   void notifyListenersTrackEnd();
   void notifyListenersFrame(const QImage& frame);
+  bool loadTrack(const std::string& filePath, uint64_t generation,
+                 const LoadProgress& progress);
+  void clearTrack();
   volatile bool videoEndedFlag;
   volatile bool audioEndedFlag;
 
-  libmueb::MuebTransmitter& transmitter;
-  MatrixVideoPlayer videoPlayer;
+  MatrixMetrics metrics;
+
+  // frame timing, A/V sync and the audio service of both sub-players all run
+  // on this one thread, it has to outlive them
+  MatrixReactor reactor;
+
+  // declared before the video player, which presents into them until it is
+  // destroyed
+  std::mutex outputMutex;  // the reactor walks outputs on every frame
+  // shared with a load staging into them, which may outlive their removal
+  std::vector<std::shared_ptr<MatrixOutputSink>> outputs;
+  std::vector<QImage> trackFrames;
+  std::unique_ptr<MatrixFrameSource> liveSource;  // replaces trackFrames
+  std::string trackName;  // guarded by subPlayerMutex
+  std::chrono::microseconds keepaliveInterval;
+  MatrixRealtime::Options realtimeOptions;
+  MatrixCompositor compositor;
+  MatrixFilterChain filterChain;
+  // reactor only: the last frame composed and filtered, reused for the rest
+  // of its run while the layers and filter settings stay the same
+  QImage processedSource;
+  QImage processedFrame;
+  uint64_t processedLayerGeneration = 0;   // 0 while not composing
+  uint64_t processedFilterGeneration = 0;  // 0 while not filtering
+  uint64_t processedGeneration = 0;  // of both, handed to the outputs
+
+  // held through every dispatch, replaced rather than changed so a callback
+  // may add or remove listeners without breaking the loop calling it
+  std::recursive_mutex listenerMutex;
+  std::shared_ptr<const std::set<MatrixPlayerListener*>> listeners;
+
+  // declared before the sub-players, which still notify as they are
+  // destroyed
   VideoListener videoListener;
-  MatrixAudioPlayer audioPlayer;
   AudioListener audioListener;
+  MatrixVideoPlayer videoPlayer;
+  MatrixAudioPlayer audioPlayer;
   bool hasAudio;
+  bool isResumedAfterScrub = false;
 
-  std::thread synchronizerThread;
+  // far enough ahead for both sub-players and the FMOD mixer to get ready
+  static constexpr std::chrono::microseconds StartLead{30 * 1000};
+  // returns the instant both start at
+  MatrixClock::time_point startPlayers();
   void startSynchronizer();
   void stopSynchronizer();
-  volatile bool runSynchronizer;
+  std::atomic<MatrixReactor::TimerId> synchronizerTimer;
   mutable std::mutex subPlayerMutex;
+  MatrixClock* clock = &MatrixClock::system();
+  std::recursive_mutex controlMutex;  // serializes control from several threads
 
-  std::set<MatrixPlayerListener*> listeners;
+  std::atomic<uint64_t> loadGeneration;  // bumped to cancel running loads
+  std::thread loaderThread;
+  std::mutex loaderMutex;
+  std::mutex stagingMutex;  // one load stages into the sub-players at a time
 };
 
 template <class Rep, class Period>
 void MatrixPlayer::setTime(std::chrono::duration<Rep, Period> time) {
+  std::lock_guard<std::recursive_mutex> lk(controlMutex);
   audioEndedFlag = videoEndedFlag = false;
-  videoPlayer.play();
-  audioPlayer.play();
-  videoPlayer.setTime(time);
+  // a playing track jumps right away, a stopped or paused one goes on from
+  // time at the instant both sub-players start
+  bool isPlaying = videoPlayer.getState() == MatrixVideoPlayer::PLAYING;
+  auto start = startPlayers();
+  auto mediaTime = std::chrono::duration_cast<std::chrono::microseconds>(time);
+  if (isPlaying) {
+    videoPlayer.setTime(mediaTime);
+  } else {
+    videoPlayer.setTimeAt(mediaTime, start);
+  }
   audioPlayer.setTime(time);
 }
 
@@ -2,6 +2,7 @@
 
 #include <QFileDialog>
 #include <QGraphicsScene>
+#include <QStandardPaths>
 #include <QStringListModel>
 #include <QTimer>
 #include <chrono>
@@ -37,6 +38,13 @@ class PlayListItem : public QListWidgetItem {
   }
   virtual QString text() const { return path + fileName; }
 
+  /// Shown after the file name, e.g. the duration.
+  void setInfo(const QString& text) {
+    info = text;
+    QListWidgetItem::setText(info.isEmpty() ? fileName
+                                            : fileName + "  " + info);
+  }
+
   virtual bool isBreakpoint() const { return false; }
 
  protected:
@@ -57,6 +65,7 @@ class PlayListItem : public QListWidgetItem {
 
   QString path;
   QString fileName;
+  QString info;
 };
 
 class PlayListBreakpoint : public PlayListItem {
@@ -89,7 +98,13 @@ MatrixPlayerWindow::MatrixPlayerWindow(QWidget* parent)
 
   timer = new QTimer(this);
   connect(timer, SIGNAL(timeout()), this, SLOT(on_updateTimeIndicator()));
-  timer->start(200);  // time specified in ms
+  timer->start(50);  // time specified in ms, polling the player is cheap
+
+  isPlayPending = false;
+  loadProgress = 0;
+  isScanning = false;
+  loadTimer = new QTimer(this);
+  connect(loadTimer, SIGNAL(timeout()), this, SLOT(on_checkPendingLoad()));
 
   graphicsScene = new QGraphicsScene;
   ui->frameView->setScene(graphicsScene);
@@ -100,6 +115,14 @@ MatrixPlayerWindow::MatrixPlayerWindow(QWidget* parent)
 
   ui->volumeSlider->setValue(matrixPlayer.getVolume() * 100);
 
+  // metadata of every file ever added, so durations show up right away
+  QString dataDir =
+      QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+  if (QDir().mkpath(dataDir)) {
+    libraryIndexPath = (dataDir + "/library.index").toStdString();
+    library.loadIndex(libraryIndexPath);
+  }
+
   // Set button icons
   ui->buttonPrevTrack->setIcon(
       style()->standardIcon(QStyle::SP_MediaSkipBackward));
@@ -115,7 +138,16 @@ MatrixPlayerWindow::MatrixPlayerWindow(QWidget* parent)
 }
 
 MatrixPlayerWindow::~MatrixPlayerWindow() {
+  {
+    // finish the batch being probed, drop the rest
+    lock_guard<mutex> lk(scanMutex);
+    scanQueue.clear();
+  }
+  if (scanThread.joinable()) {
+    scanThread.join();
+  }
   timer->stop();
+  loadTimer->stop();
   matrixPlayer.removeListener(&playerListener);
   delete ui;
 }
@@ -123,14 +155,89 @@ MatrixPlayerWindow::~MatrixPlayerWindow() {
 void MatrixPlayerWindow::on_buttonAddMedia_clicked() {
   QStringList files =
       QFileDialog::getOpenFileNames(this, "Add media", QString(), "*.q4x");
+  vector<PlayListItem*> items;
+  vector<string> paths;
   for (auto it = files.begin(); it != files.end(); ++it) {
     QString fileName = *it;
-    ui->playlistView->insertItem(ui->playlistView->currentRow() + 1,
-                                 new PlayListItem(fileName));
+    PlayListItem* item = new PlayListItem(fileName);
+    ui->playlistView->insertItem(ui->playlistView->currentRow() + 1, item);
     ui->playlistView->setCurrentRow(ui->playlistView->currentRow() + 1);
+    items.push_back(item);
+    paths.push_back(item->text().toStdString());
+  }
+
+  // described right away if already known, probing new or changed files
+  // can take long and runs in the background
+  for (PlayListItem* item : items) {
+    describeMedia(item);
+  }
+  lock_guard<mutex> lk(scanMutex);
+  scanQueue.insert(scanQueue.end(), paths.begin(), paths.end());
+  if (!isScanning) {
+    isScanning = true;
+    if (scanThread.joinable()) {
+      scanThread.join();  // done with its last batch, about to return
+    }
+    scanThread = thread([this] { scanThreadFunc(); });
+  }
+}
+
+void MatrixPlayerWindow::scanThreadFunc() {
+  while (true) {
+    vector<string> paths;
+    {
+      lock_guard<mutex> lk(scanMutex);
+      if (scanQueue.empty()) {
+        isScanning = false;
+        return;
+      }
+      paths.swap(scanQueue);
+    }
+    // only files not seen before, or changed since, are actually read
+    bool isChanged = library.scanFiles(paths) > 0;
+    QMetaObject::invokeMethod(this, "on_libraryScanned", Qt::QueuedConnection,
+                              Q_ARG(bool, isChanged));
   }
 }
 
+void MatrixPlayerWindow::on_libraryScanned(bool isChanged) {
+  if (isChanged && !libraryIndexPath.empty()) {
+    library.saveIndex(libraryIndexPath);
+  }
+  // items may have been removed meanwhile, describe whatever is listed
+  for (int row = 0; row < ui->playlistView->count(); row++) {
+    PlayListItem* item =
+        dynamic_cast<PlayListItem*>(ui->playlistView->item(row));
+    if (item) {
+      describeMedia(item);
+    }
+  }
+}
+
+void MatrixPlayerWindow::describeMedia(PlayListItem* item) {
+  MatrixLibrary::Entry entry;
+  if (!library.find(item->text().toStdString(), entry)) {
+    return;
+  }
+  if (!entry.isValid) {
+    item->setInfo("(broken)");
+    item->setForeground(Qt::red);
+    item->setToolTip("This file is not a valid q4x show.");
+    return;
+  }
+
+  const Q4XLoader::Info& info = entry.info;
+  item->setInfo("(" + secondsToTimestamp(info.duration.count() / 1000000) +
+                ")");
+  item->setToolTip(QString::fromStdString(info.title) + "\n" +
+                   QString::number(info.width) + "x" +
+                   QString::number(info.height) + ", " +
+                   QString::number(info.frameCount) + " frames" +
+                   (info.hasAudio ? ", audio: " +
+                                        QString::fromStdString(info.audio)
+                                  : QString(", no audio")));
+}
+
 void MatrixPlayerWindow::on_buttonInsertBreakpoint_clicked() {
   ui->playlistView->insertItem(ui->playlistView->currentRow() + 1,
                                new PlayListBreakpoint());
@@ -144,6 +251,7 @@ void MatrixPlayerWindow::on_buttonRemoveMedia_clicked() {
       lock_guard<recursive_mutex> lk(matrixPlayerMutex);
 
       matrixPlayer.clear();
+      cancelPendingLoad();
 
       intptr_t index = ui->playlistView->row(currentMedia);
       delete currentMedia;
@@ -169,6 +277,7 @@ void MatrixPlayerWindow::on_buttonRemoveMedia_clicked() {
 
 void MatrixPlayerWindow::on_buttonClearMedia_clicked() {
   matrixPlayer.clear();
+  cancelPendingLoad();
   ui->playlistView->clear();
   currentMedia = nullptr;
   ui->buttonPlay->setIcon(style()->standardIcon(QStyle::SP_MediaPlay));
@@ -201,9 +310,7 @@ void MatrixPlayerWindow::on_buttonPlay_clicked() {
       font.setItalic(true);
       currentMedia->setFont(font);
       // if there's a current media already set, load and play it
-      if (loadCurrentMedia()) {
-        matrixPlayer.play();
-      }
+      loadCurrentMedia(true);
     }
   } else if (state == MatrixPlayer::STOPPED) {
     matrixPlayer.play();
@@ -228,16 +335,17 @@ void MatrixPlayerWindow::on_buttonStop_clicked() {
 
 void MatrixPlayerWindow::on_updateTimeIndicator() {
   if (shouldUpdateTime) {
-    lock_guard<recursive_mutex> lk(matrixPlayerMutex);
-
-    long long timeUs = matrixPlayer.getTime().count();
+    // lock-free, playback never waits for the indicator
+    auto snapshot = matrixPlayer.getSnapshot();
+    long long timeUs =
+        snapshot.positionAt(matrixPlayer.getClock()->now()).count();
 
     // set slider
     ui->mediaTimeIndicator->setValue(timeUs / 1000);
 
     // set textual indicators
     long long timeSec = timeUs / 1000000;
-    long long durationSec = matrixPlayer.getDuration().count() / 1000000;
+    long long durationSec = snapshot.duration.count() / 1000000;
     long long remainingSec = durationSec - timeSec;
     QString timeText = secondsToTimestamp(timeSec);
     QString remainingText = secondsToTimestamp(-remainingSec);
@@ -256,6 +364,7 @@ void MatrixPlayerWindow::on_playlistView_itemDoubleClicked(
   lock_guard<recursive_mutex> lk(matrixPlayerMutex);
 
   matrixPlayer.clear();
+  cancelPendingLoad();
   if (currentMedia) {
     QFont font = currentMedia->font();
     font.setBold(false);
@@ -303,7 +412,10 @@ bool MatrixPlayerWindow::seekPlaylist(intptr_t offset) {
     lock_guard<recursive_mutex> lk(matrixPlayerMutex);
 
     MatrixPlayer::eState prevState = matrixPlayer.getState();
+    bool isPlayRequested = prevState == MatrixPlayer::PLAYING ||
+                           (pendingLoad.valid() && isPlayPending);
     matrixPlayer.clear();
+    cancelPendingLoad();
 
     auto font = currentMedia->font();
     font.setBold(false);
@@ -314,9 +426,7 @@ bool MatrixPlayerWindow::seekPlaylist(intptr_t offset) {
     nextMedia->setFont(font);
 
     currentMedia = nextMedia;
-    if (loadCurrentMedia() && prevState == MatrixPlayer::PLAYING) {
-      matrixPlayer.play();
-    }
+    loadCurrentMedia(isPlayRequested);
 
     return isBreakpointHit;
   }
@@ -324,33 +434,83 @@ bool MatrixPlayerWindow::seekPlaylist(intptr_t offset) {
 
 void MatrixPlayerWindow::on_mediaTimeIndicator_sliderPressed() {
   shouldUpdateTime = false;
+  lock_guard<recursive_mutex> lk(matrixPlayerMutex);
+  matrixPlayer.beginScrub();
+}
+
+// the facade and the preview follow the slider while it is dragged
+void MatrixPlayerWindow::on_mediaTimeIndicator_sliderMoved(int value) {
+  matrixPlayer.scrubTo(milliseconds(value));
 }
 
 void MatrixPlayerWindow::on_mediaTimeIndicator_sliderReleased() {
   lock_guard<recursive_mutex> lk(matrixPlayerMutex);
   intptr_t seekMs = ui->mediaTimeIndicator->value();
-  matrixPlayer.setTime(milliseconds(seekMs));
+  if (matrixPlayer.isScrubbing()) {
+    matrixPlayer.scrubTo(milliseconds(seekMs));
+    matrixPlayer.endScrub();
+  } else {
+    matrixPlayer.setTime(milliseconds(seekMs));
+  }
   shouldUpdateTime = true;
 }
 
-// if there's a current media already set, load and play it
-bool MatrixPlayerWindow::loadCurrentMedia() {
-  if (currentMedia) {
-    bool isLoaded = matrixPlayer.load(currentMedia->text().toStdString());
-    if (isLoaded) {
-      int durationUs = matrixPlayer.getDuration().count();
-      QString durationText =
-          "(" + secondsToTimestamp(durationUs / 1000000) + ") ";
-      ui->labelTrackName->setText(
-          durationText + dynamic_cast<PlayListItem*>(currentMedia)->text());
-      ui->mediaTimeIndicator->setMaximum(durationUs / 1000 +
-                                         1);  // time indicator in ms!!!
-    } else {
-      ui->labelTrackName->setText("media could not be loaded");
+// load the current media in the background and play it when asked to, the
+// window stays responsive while large files decode
+void MatrixPlayerWindow::loadCurrentMedia(bool isPlayRequested) {
+  if (!currentMedia) {
+    return;
+  }
+  isPlayPending = isPlayRequested;
+  if (pendingLoad.valid()) {
+    return;  // already on its way, only the play request changed
+  }
+
+  loadProgress = 0;
+  ui->labelTrackName->setText("loading " + currentMedia->text());
+  pendingLoad = matrixPlayer.loadAsync(
+      currentMedia->text().toStdString(),
+      [this](float progress) { loadProgress = progress; });
+  loadTimer->start(20);
+}
+
+void MatrixPlayerWindow::cancelPendingLoad() {
+  // the player already cancelled the load itself, just forget about it
+  pendingLoad = future<bool>();
+  isPlayPending = false;
+  loadTimer->stop();
+}
+
+void MatrixPlayerWindow::on_checkPendingLoad() {
+  if (!pendingLoad.valid() || !currentMedia) {
+    loadTimer->stop();
+    return;
+  }
+  if (pendingLoad.wait_for(seconds(0)) != future_status::ready) {
+    ui->labelTrackName->setText(
+        "loading " + QString::number(int(loadProgress * 100)) + "% " +
+        currentMedia->text());
+    return;
+  }
+  loadTimer->stop();
+
+  lock_guard<recursive_mutex> lk(matrixPlayerMutex);
+  bool isLoaded = pendingLoad.get();
+  if (isLoaded) {
+    int durationUs = matrixPlayer.getDuration().count();
+    QString durationText =
+        "(" + secondsToTimestamp(durationUs / 1000000) + ") ";
+    ui->labelTrackName->setText(durationText + currentMedia->text());
+    ui->mediaTimeIndicator->setMaximum(durationUs / 1000 +
+                                       1);  // time indicator in ms!!!
+    if (isPlayPending) {
+      matrixPlayer.play();
+      ui->buttonPlay->setIcon(style()->standardIcon(QStyle::SP_MediaPause));
     }
-    return isLoaded;
+  } else {
+    ui->labelTrackName->setText("media could not be loaded");
   }
-  return false;
+  isPlayPending = false;
 }
 
 PlayerListener::PlayerListener(MatrixPlayerWindow& parent) : parent(parent) {}
@@ -2,8 +2,14 @@
 #define MATRIXPLAYERWINDOW_H
 
 #include <QMainWindow>
+#include <atomic>
+#include <future>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "MatrixLibrary.h"
 #include "MatrixPlayer.h"
 
 class QStringListModel;
@@ -40,6 +46,8 @@ class MatrixPlayerWindow : public QMainWindow {
  private slots:
   void on_updateTimeIndicator();
 
+  void on_checkPendingLoad();
+
   void on_buttonAddMedia_clicked();
 
   void on_buttonRemoveMedia_clicked();
@@ -58,10 +66,14 @@ class MatrixPlayerWindow : public QMainWindow {
 
   void on_mediaTimeIndicator_sliderPressed();
 
+  void on_mediaTimeIndicator_sliderMoved(int value);
+
   void on_mediaTimeIndicator_sliderReleased();
 
   void on_trackEnded();
 
+  void on_libraryScanned(bool isChanged);
+
   void on_volumeSlider_valueChanged(int value);
 
   void on_checkAutoplay_clicked(bool checked);
@@ -69,9 +81,11 @@ class MatrixPlayerWindow : public QMainWindow {
   void on_buttonInsertBreakpoint_clicked();
 
  private:
-  bool loadCurrentMedia();
+  void loadCurrentMedia(bool isPlayRequested);
+  void cancelPendingLoad();
   bool seekPlaylist(intptr_t offset);
   QString secondsToTimestamp(int seconds);
+  void describeMedia(PlayListItem* item);
 
   Ui::MatrixPlayerWindow* ui;
   MatrixPlayer matrixPlayer;
@@ -80,8 +94,24 @@ class MatrixPlayerWindow : public QMainWindow {
   bool shouldUpdateTime;
   std::atomic_bool autoplay;
 
+  MatrixLibrary library;
+  std::string libraryIndexPath;
+  // added files are probed on scanThread, which drains scanQueue and
+  // reports each batch back through on_libraryScanned
+  void scanThreadFunc();
+  std::thread scanThread;
+  std::mutex scanMutex;
+  std::vector<std::string> scanQueue;
+  bool isScanning;
+
   QTimer* timer;
 
+  // the current media is loaded in the background, polled by loadTimer
+  std::future<bool> pendingLoad;
+  bool isPlayPending;
+  std::atomic<float> loadProgress;
+  QTimer* loadTimer;
+
   QGraphicsScene* graphicsScene;
   PlayerListener playerListener;
 
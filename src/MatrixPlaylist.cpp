@@ -0,0 +1,92 @@
+#include "MatrixPlaylist.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+MatrixPlaylist::MatrixPlaylist() { current = 0; }
+
+bool MatrixPlaylist::load(const std::string& filePath) {
+  ifstream inputFile(filePath);
+  if (!inputFile.is_open()) {
+    cout << "Could not open playlist " << filePath << endl;
+    return false;
+  }
+
+  // relative entries are relative to the playlist itself
+  string baseDir;
+  size_t separator = filePath.find_last_of("/\\");
+  if (separator != string::npos) {
+    baseDir = filePath.substr(0, separator + 1);
+  }
+
+  string line;
+  while (getline(inputFile, line)) {
+    // trim whitespace and windows line endings
+    size_t first = line.find_first_not_of(" \t\r");
+    size_t last = line.find_last_not_of(" \t\r");
+    if (first == string::npos) {
+      continue;
+    }
+    line = line.substr(first, last - first + 1);
+
+    if (line[0] == '#') {
+      continue;
+    } else if (line == "---") {
+      addBreakpoint();
+    } else if (line[0] == '/' || line[0] == '\\' ||
+               (line.size() > 1 && line[1] == ':')) {
+      add(line);
+    } else {
+      add(baseDir + line);
+    }
+  }
+
+  return true;
+}
+
+void MatrixPlaylist::add(const std::string& path) {
+  entries.push_back({path, false});
+}
+
+void MatrixPlaylist::addBreakpoint() { entries.push_back({"", true}); }
+
+void MatrixPlaylist::clear() {
+  entries.clear();
+  current = 0;
+}
+
+bool MatrixPlaylist::setCurrentIndex(size_t index) {
+  if (index >= entries.size() || entries[index].isBreakpoint) {
+    return false;
+  }
+  current = index;
+  return true;
+}
+
+bool MatrixPlaylist::seek(intptr_t offset) {
+  if (entries.empty()) {
+    return false;
+  }
+
+  intptr_t numItems = entries.size();
+  intptr_t nextIndex = current;
+  bool isBreakpointHit = false;
+  // every entry is visited at most once, however many are breakpoints
+  for (intptr_t step = 0; step < numItems; step++) {
+    nextIndex = ((nextIndex + offset) % numItems + numItems) % numItems;
+    if (!entries[nextIndex].isBreakpoint) {
+      break;
+    }
+    isBreakpointHit = true;
+  }
+
+  // a playlist made of breakpoints only has nothing to play
+  if (!entries[nextIndex].isBreakpoint) {
+    current = nextIndex;
+  }
+
+  return isBreakpointHit;
+}
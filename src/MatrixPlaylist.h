@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Ordered list of q4x files with optional breakpoints, the same model the
+/// GUI playlist uses, but without any Qt widgets attached.
+class MatrixPlaylist {
+ public:
+  struct Entry {
+    std::string path;
+    bool isBreakpoint;
+  };
+
+  MatrixPlaylist();
+
+  /// Read a playlist file: one path per line, "---" marks a breakpoint, lines
+  /// starting with '#' are comments. Relative paths are resolved against the
+  /// directory of the playlist file.
+  bool load(const std::string& filePath);
+
+  void add(const std::string& path);
+  void addBreakpoint();
+  void clear();
+
+  // --- Get state --- //
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  const Entry& operator[](size_t index) const { return entries[index]; }
+
+  size_t currentIndex() const { return current; }
+  const std::string& currentPath() const { return entries[current].path; }
+  bool setCurrentIndex(size_t index);
+
+  /// Step offset entries, skipping breakpoints and wrapping around.
+  /// Returns true if a breakpoint was passed on the way.
+  bool seek(intptr_t offset);
+
+ private:
+  std::vector<Entry> entries;
+  size_t current;
+};
@@ -0,0 +1,150 @@
+#include "MatrixReactor.h"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+
+#include "MatrixTrace.h"
+
+using namespace std;
+
+MatrixReactor::MatrixReactor() {
+  nextTimerId = 1;
+  runningTimer = 0;
+  changes = 0;
+  running = true;
+  reactorThread = thread([this] { reactorThreadFunc(); });
+}
+
+MatrixReactor::~MatrixReactor() {
+  {
+    lock_guard<mutex> lk(mtx);
+    running = false;
+    changes++;
+  }
+  cv.notify_all();
+  reactorThread.join();
+}
+
+void MatrixReactor::setClock(MatrixClock* clock) {
+  {
+    lock_guard<mutex> lk(mtx);
+    this->clock = clock;
+    changes++;
+  }
+  // the reactor may be waiting on the old clock, make it wait again
+  cv.notify_all();
+}
+
+void MatrixReactor::post(Task task) {
+  {
+    lock_guard<mutex> lk(mtx);
+    tasks.push(std::move(task));
+    changes++;
+  }
+  cv.notify_all();
+}
+
+void MatrixReactor::flush() {
+  if (isReactorThread()) {
+    return;  // the reactor cannot wait for itself
+  }
+  auto flushed = make_shared<promise<void>>();
+  auto result = flushed->get_future();
+  post([flushed] { flushed->set_value(); });
+  result.wait();
+}
+
+auto MatrixReactor::schedule(MatrixClock::time_point deadline, Task task)
+    -> TimerId {
+  return add(deadline, MatrixClock::duration::zero(), std::move(task));
+}
+
+auto MatrixReactor::schedulePeriodic(MatrixClock::duration period, Task task)
+    -> TimerId {
+  return add(clock.load()->now() + period, period, std::move(task));
+}
+
+auto MatrixReactor::add(MatrixClock::time_point deadline,
+                        MatrixClock::duration period, Task task) -> TimerId {
+  TimerId id;
+  {
+    lock_guard<mutex> lk(mtx);
+    id = nextTimerId++;
+    timers.push_back({id, deadline, period, std::move(task)});
+    changes++;
+  }
+  cv.notify_all();
+  return id;
+}
+
+void MatrixReactor::cancel(TimerId id) {
+  if (id == 0) {
+    return;
+  }
+  unique_lock<mutex> lk(mtx);
+  auto it = find_if(timers.begin(), timers.end(),
+                    [id](const Timer& timer) { return timer.id == id; });
+  if (it != timers.end()) {
+    timers.erase(it);
+    changes++;
+  }
+  if (!isReactorThread()) {
+    done.wait(lk, [this, id] { return runningTimer != id; });
+  }
+}
+
+bool MatrixReactor::isReactorThread() const {
+  return this_thread::get_id() == reactorThread.get_id();
+}
+
+void MatrixReactor::reactorThreadFunc() {
+  MATRIX_TRACE_THREAD_NAME("reactor");
+  unique_lock<mutex> lk(mtx);
+  while (running) {
+    // control commands first, they may move or cancel what is due
+    if (!tasks.empty()) {
+      Task task = std::move(tasks.front());
+      tasks.pop();
+      lk.unlock();
+      {
+        MATRIX_TRACE_SCOPE("reactor", "task");
+        task();
+      }
+      lk.lock();
+      continue;
+    }
+
+    MatrixClock* clock = this->clock;
+    auto earliest = min_element(
+        timers.begin(), timers.end(), [](const Timer& a, const Timer& b) {
+          return a.deadline < b.deadline;
+        });
+    auto deadline = earliest == timers.end() ? MatrixClock::time_point::max()
+                                             : earliest->deadline;
+    if (deadline > clock->now()) {
+      uint64_t seen = changes;
+      clock->waitUntil(cv, lk, deadline,
+                       [this, seen] { return changes != seen; });
+      continue;  // something changed or the deadline passed, look again
+    }
+
+    // run the timer, periodic ones keep their place in the timeline
+    Timer timer = *earliest;
+    if (timer.period > MatrixClock::duration::zero()) {
+      earliest->deadline += timer.period;
+      earliest->deadline = max(earliest->deadline, clock->now());
+    } else {
+      timers.erase(earliest);
+    }
+    runningTimer = timer.id;
+    lk.unlock();
+    {
+      MATRIX_TRACE_SCOPE("reactor", "timer");
+      timer.task();
+    }
+    lk.lock();
+    runningTimer = 0;
+    done.notify_all();
+  }
+}
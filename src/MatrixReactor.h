@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+
+/// One long-lived thread running all timed playback work: frame deadlines,
+/// A/V sync sampling, the audio service and control commands.
+///
+/// Components schedule timers on the reactor instead of looping on threads
+/// of their own, so a playing track costs a single thread, the thread sleeps
+/// until the earliest deadline, and play/stop create and join nothing.
+///
+/// Waits go through a MatrixClock like every other playback wait, so a
+/// MatrixSimulatedClock drives the reactor just as well as the wall clock.
+class MatrixReactor {
+ public:
+  using TimerId = uint64_t;
+  using Task = std::function<void()>;
+
+  MatrixReactor();
+  ~MatrixReactor();
+
+  void setClock(MatrixClock* clock);
+  MatrixClock* getClock() const { return clock; }
+
+  /// Run task on the reactor thread as soon as possible, in posting order
+  /// and before any timer that is due.
+  void post(Task task);
+  /// Returns once every task posted so far has run.
+  void flush();
+
+  /// Run task once at deadline.
+  TimerId schedule(MatrixClock::time_point deadline, Task task);
+  /// Run task every period, the first time one period from now.
+  TimerId schedulePeriodic(MatrixClock::duration period, Task task);
+
+  /// The timer never runs again. Unless called on the reactor thread, this
+  /// also waits for a run of it that is already underway. Timer ids start
+  /// at 1, cancelling 0 does nothing.
+  void cancel(TimerId id);
+
+  bool isReactorThread() const;
+
+ private:
+  struct Timer {
+    TimerId id;
+    MatrixClock::time_point deadline;
+    MatrixClock::duration period;  // zero for one shot timers
+    Task task;
+  };
+
+  TimerId add(MatrixClock::time_point deadline, MatrixClock::duration period,
+              Task task);
+  void reactorThreadFunc();
+
+  std::thread reactorThread;
+  mutable std::mutex mtx;
+  std::condition_variable cv;    // wakes the reactor
+  std::condition_variable done;  // a timer run finished, for cancel()
+  std::queue<Task> tasks;
+  std::vector<Timer> timers;  // a handful at most, kept unordered
+  TimerId nextTimerId;
+  TimerId runningTimer;  // 0 if none
+  uint64_t changes;      // bumped by every call that may move the deadline
+  bool running;
+  std::atomic<MatrixClock*> clock{&MatrixClock::system()};
+};
@@ -0,0 +1,142 @@
+#include "MatrixRealtime.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+using namespace std;
+
+// the smallest page size around, touching more often than needed is harmless
+static const size_t PageSize = 4096;
+
+static string cpuList(const vector<int>& cpus) {
+  string list;
+  for (int cpu : cpus) {
+    list += (list.empty() ? "" : ",") + to_string(cpu);
+  }
+  return list;
+}
+
+bool MatrixRealtime::applyToCurrentThread(const Options& options,
+                                          const char* threadName,
+                                          bool isReporting) {
+  bool isApplied = true;
+  auto fail = [&](const string& what, const string& reason) {
+    isApplied = false;
+    if (isReporting) {
+      cout << "Real time: could not " << what << " of the " << threadName
+           << " thread: " << reason << endl;
+    }
+  };
+
+#ifdef _WIN32
+  // Windows has no priority numbers to speak of, any priority means the top
+  if (options.priority > 0 &&
+      !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+    fail("raise the priority", "error " + to_string(GetLastError()));
+  }
+  if (!options.cpus.empty()) {
+    DWORD_PTR mask = 0;
+    for (int cpu : options.cpus) {
+      if (cpu >= 0 && cpu < int(8 * sizeof(mask))) {
+        mask |= DWORD_PTR(1) << cpu;
+      }
+    }
+    if (!SetThreadAffinityMask(GetCurrentThread(), mask)) {
+      fail("pin to CPUs " + cpuList(options.cpus),
+           "error " + to_string(GetLastError()));
+    }
+  }
+#else
+  if (options.priority > 0) {
+    int policy = options.isRoundRobin ? SCHED_RR : SCHED_FIFO;
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority =
+        clamp(options.priority, sched_get_priority_min(policy),
+              sched_get_priority_max(policy));
+    int error = pthread_setschedparam(pthread_self(), policy, &param);
+    if (error) {
+      fail(string("set ") + (options.isRoundRobin ? "SCHED_RR" : "SCHED_FIFO") +
+               " priority " + to_string(param.sched_priority),
+           strerror(error));
+    }
+  }
+  if (!options.cpus.empty()) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : options.cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error) {
+      fail("pin to CPUs " + cpuList(options.cpus), strerror(error));
+    }
+#else
+    fail("pin to CPUs " + cpuList(options.cpus), "not supported here");
+#endif
+  }
+#endif
+  return isApplied;
+}
+
+bool MatrixRealtime::lockMemory(const Options& options) {
+  if (!options.isMemoryLocked) {
+    return true;
+  }
+#ifdef _WIN32
+  cout << "Real time: locking memory is not supported on Windows" << endl;
+  return false;
+#else
+  // With a limit, allocations beyond it would fail once future pages are
+  // locked, loading the next track included. Don't lock at all then.
+  rlimit limit;
+  if (geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+      limit.rlim_cur != RLIM_INFINITY) {
+    cout << "Real time: could not lock memory: the memlock limit is "
+         << limit.rlim_cur / 1024 << " KB, it has to be unlimited" << endl;
+    return false;
+  }
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    cout << "Real time: could not lock memory: " << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+#endif
+}
+
+void MatrixRealtime::prefault(const std::vector<QImage>& frames) {
+  volatile uint8_t sum = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const QImage& frame = frames[i];
+    if (i > 0 && frame.cacheKey() == frames[i - 1].cacheKey()) {
+      continue;  // a hold shares the image of the frame before
+    }
+    const uint8_t* bits = frame.constBits();
+    size_t size = frame.sizeInBytes();
+    for (size_t offset = 0; offset < size; offset += PageSize) {
+      sum = sum + bits[offset];
+    }
+    if (size > 0) {
+      sum = sum + bits[size - 1];
+    }
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QImage>
+#include <vector>
+
+/// Real time tuning of the playback threads, so frame deadlines survive
+/// whatever else runs on the show PC.
+///
+/// Most of it needs privileges the process may not have, on Linux
+/// CAP_SYS_NICE or an rtprio limit for the scheduling and CAP_IPC_LOCK or
+/// an unlimited memlock limit for locking memory. Whatever cannot be
+/// applied is reported and skipped, playback goes on without it.
+class MatrixRealtime {
+ public:
+  struct Options {
+    int priority = 0;             // 1-99, 0 keeps the normal scheduler
+    bool isRoundRobin = false;    // SCHED_RR instead of SCHED_FIFO
+    std::vector<int> cpus;        // pin to these CPUs, empty lets the OS pick
+    bool isMemoryLocked = false;  // keep all current and future pages in RAM
+    bool isPrefaulting = false;   // touch every frame page after a load
+  };
+
+  /// Scheduling and CPU affinity of the calling thread. Returns false if any
+  /// of it could not be applied, the reason is printed if isReporting.
+  static bool applyToCurrentThread(const Options& options,
+                                   const char* threadName,
+                                   bool isReporting = true);
+  /// Lock the process' memory if the options ask for it.
+  static bool lockMemory(const Options& options);
+  /// Read every page of the frames once, so none of them has to be faulted
+  /// or swapped in while playing.
+  static void prefault(const std::vector<QImage>& frames);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// A value written rarely and read often from other threads, neither side
+/// ever blocks. Readers retry when they overlap a write, so a read costs a
+/// few loads and never slows down the writer.
+///
+/// Stores must not race with each other, the writer side has to serialize
+/// them with a lock of its own.
+template <class T>
+class MatrixSeqlock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "seqlock values are copied word by word");
+
+ public:
+  MatrixSeqlock() : sequence(0) { store(T()); }
+
+  void store(const T& value) {
+    uint64_t words[WordCount] = {};
+    memcpy(words, &value, sizeof(T));
+
+    // odd while the words are inconsistent
+    uint32_t start = sequence.load(std::memory_order_relaxed);
+    sequence.store(start + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WordCount; i++) {
+      data[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence.store(start + 2, std::memory_order_release);
+  }
+
+  T load() const {
+    uint64_t words[WordCount];
+    uint32_t before, after;
+    do {
+      before = sequence.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WordCount; i++) {
+        words[i] = data[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+    } while (before != after || (before & 1));
+
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+ private:
+  static constexpr size_t WordCount = (sizeof(T) + 7) / 8;
+
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint64_t> data[WordCount];
+};
@@ -0,0 +1,296 @@
+#include "MatrixSharedMemorySource.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+static_assert(sizeof(MatrixSharedMemorySource::Header) <=
+                  MatrixSharedMemorySource::HeaderSize,
+              "header does not fit");
+static_assert(sizeof(MatrixSharedMemorySource::Slot) <=
+                  MatrixSharedMemorySource::SlotHeaderSize,
+              "slot header does not fit");
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "shared atomics have to be lock-free to work across processes");
+
+struct MatrixSharedMemorySource::Mapping {
+  void* address = MAP_FAILED;
+  size_t size = 0;
+
+  ~Mapping() {
+    if (address != MAP_FAILED) {
+      munmap(address, size);
+    }
+  }
+
+  Header& header() const { return *static_cast<Header*>(address); }
+  Slot& slot(uint32_t index) const {
+    return *reinterpret_cast<Slot*>(static_cast<uint8_t*>(address) +
+                                    HeaderSize + index * header().slotSize);
+  }
+  uint8_t* pixels(uint32_t index) const {
+    return reinterpret_cast<uint8_t*>(&slot(index)) + SlotHeaderSize;
+  }
+};
+
+// a slot a frame points into, released by QImage once its last copy is gone
+struct HeldSlot {
+  shared_ptr<MatrixSharedMemorySource::Mapping> mapping;
+  uint32_t index;
+};
+
+static void releaseSlot(void* info) {
+  auto held = static_cast<HeldSlot*>(info);
+  held->mapping->slot(held->index).readers--;
+  delete held;
+}
+
+static size_t alignUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reader
+
+MatrixSharedMemorySource::MatrixSharedMemorySource() {}
+
+MatrixSharedMemorySource::~MatrixSharedMemorySource() { close(); }
+
+bool MatrixSharedMemorySource::open(const std::string& name) {
+  close();
+
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    cout << "Could not open shared memory " << name << ": " << strerror(errno)
+         << endl;
+    return false;
+  }
+  struct stat info;
+  auto newMapping = make_shared<Mapping>();
+  if (fstat(fd, &info) == 0 && size_t(info.st_size) >= HeaderSize) {
+    newMapping->size = info.st_size;
+    newMapping->address = mmap(nullptr, newMapping->size,
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (newMapping->address == MAP_FAILED) {
+    cout << "Could not map shared memory " << name << endl;
+    return false;
+  }
+
+  const Header& header = newMapping->header();
+  size_t frameSize = size_t(header.bytesPerLine) * header.height;
+  if (header.magic != Magic || header.version != Version ||
+      header.width == 0 || header.height == 0 ||
+      header.bytesPerLine < 3 * header.width || header.bytesPerLine % 4 ||
+      header.slotCount == 0 || header.slotSize < SlotHeaderSize + frameSize ||
+      newMapping->size < HeaderSize + header.slotCount * header.slotSize) {
+    cout << "Shared memory " << name << " holds no frame ring" << endl;
+    return false;
+  }
+
+  mapping = newMapping;
+  return true;
+}
+
+void MatrixSharedMemorySource::close() { mapping.reset(); }
+
+int MatrixSharedMemorySource::width() const {
+  return mapping ? mapping->header().width : 0;
+}
+
+int MatrixSharedMemorySource::height() const {
+  return mapping ? mapping->header().height : 0;
+}
+
+bool MatrixSharedMemorySource::acquire(Frame& frame) {
+  if (!mapping) {
+    return false;
+  }
+  const Header& header = mapping->header();
+
+  // the producer may lap the slot between reading latest and counting
+  // ourselves in, a few retries are plenty at any sane frame rate
+  for (int attempt = 0; attempt < 4; attempt++) {
+    uint32_t latest = header.latest.load(memory_order_acquire);
+    if (latest == 0 || latest > header.slotCount) {
+      return false;
+    }
+    uint32_t index = latest - 1;
+    Slot& slot = mapping->slot(index);
+
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    if (sequence == 2 * frame.sequence && !frame.image.isNull()) {
+      return true;  // still the frame the caller holds
+    }
+    slot.readers++;
+    if (slot.sequence.load() != sequence) {
+      slot.readers--;
+      continue;
+    }
+
+    frame.image = QImage(mapping->pixels(index), header.width, header.height,
+                         header.bytesPerLine, QImage::Format_RGB888,
+                         releaseSlot, new HeldSlot{mapping, index});
+    frame.sequence = sequence / 2;
+    frame.writeTime = MatrixClock::time_point(duration_cast<
+        MatrixClock::duration>(nanoseconds(slot.writeTimeNs.load())));
+    return true;
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writer
+
+MatrixSharedMemoryWriter::MatrixSharedMemoryWriter() {
+  writingSlot = 0;
+  frameCount = 0;
+}
+
+MatrixSharedMemoryWriter::~MatrixSharedMemoryWriter() { close(); }
+
+bool MatrixSharedMemoryWriter::create(const std::string& name, int width,
+                                      int height, size_t slotCount) {
+  using Source = MatrixSharedMemorySource;
+  close();
+  if (width <= 0 || height <= 0 || slotCount < 3) {
+    cout << "Shared memory frames need a size and at least 3 slots" << endl;
+    return false;
+  }
+
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (fd < 0) {
+    cout << "Could not create shared memory " << name << ": "
+         << strerror(errno) << endl;
+    return false;
+  }
+  size_t bytesPerLine = alignUp(3 * size_t(width), 4);
+  size_t slotSize =
+      alignUp(Source::SlotHeaderSize + bytesPerLine * height, 64);
+  auto newMapping = make_shared<Source::Mapping>();
+  newMapping->size = Source::HeaderSize + slotCount * slotSize;
+  if (ftruncate(fd, newMapping->size) == 0) {
+    newMapping->address = mmap(nullptr, newMapping->size,
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (newMapping->address == MAP_FAILED) {
+    cout << "Could not map shared memory " << name << endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // a fresh segment is zeroed, the header goes last so readers only ever
+  // see a complete one
+  Source::Header& header = newMapping->header();
+  header.width = width;
+  header.height = height;
+  header.bytesPerLine = bytesPerLine;
+  header.slotCount = slotCount;
+  header.slotSize = slotSize;
+  header.version = Source::Version;
+  atomic_thread_fence(memory_order_release);
+  header.magic = Source::Magic;
+
+  this->name = name;
+  mapping = newMapping;
+  writingSlot = 0;
+  frameCount = 0;
+  return true;
+}
+
+void MatrixSharedMemoryWriter::close() {
+  if (mapping) {
+    shm_unlink(name.c_str());
+    mapping.reset();
+  }
+}
+
+int MatrixSharedMemoryWriter::width() const {
+  return mapping ? mapping->header().width : 0;
+}
+
+int MatrixSharedMemoryWriter::height() const {
+  return mapping ? mapping->header().height : 0;
+}
+
+size_t MatrixSharedMemoryWriter::bytesPerLine() const {
+  return mapping ? mapping->header().bytesPerLine : 0;
+}
+
+uint8_t* MatrixSharedMemoryWriter::beginFrame() {
+  if (!mapping) {
+    return nullptr;
+  }
+  if (writingSlot) {
+    return mapping->pixels(writingSlot - 1);  // begun and not published
+  }
+  auto& header = mapping->header();
+  uint32_t latest = header.latest.load(memory_order_relaxed);
+
+  for (uint32_t index = 0; index < header.slotCount; index++) {
+    auto& slot = mapping->slot(index);
+    if (index + 1 == latest || slot.readers.load() != 0) {
+      continue;
+    }
+    uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+    slot.sequence.store(sequence | 1);
+    if (slot.readers.load() != 0) {
+      slot.sequence.store(sequence);  // a reader got in first
+      continue;
+    }
+    writingSlot = index + 1;
+    return mapping->pixels(index);
+  }
+  return nullptr;
+}
+
+void MatrixSharedMemoryWriter::publishFrame() {
+  if (!mapping || !writingSlot) {
+    return;
+  }
+  auto& slot = mapping->slot(writingSlot - 1);
+  slot.writeTimeNs.store(
+      duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+          .count(),
+      memory_order_relaxed);
+  slot.sequence.store(2 * ++frameCount, memory_order_release);
+  mapping->header().latest.store(writingSlot, memory_order_release);
+  writingSlot = 0;
+}
+
+bool MatrixSharedMemoryWriter::write(const QImage& frame) {
+  int frameWidth = width();
+  int frameHeight = height();
+  if (frame.width() != frameWidth || frame.height() != frameHeight) {
+    return false;
+  }
+  uint8_t* pixels = beginFrame();
+  if (!pixels) {
+    return false;
+  }
+
+  const QImage& source = frame.format() == QImage::Format_RGB888
+                             ? frame
+                             : frame.convertToFormat(QImage::Format_RGB888);
+  size_t lineSize = 3 * size_t(frameWidth);
+  for (int y = 0; y < frameHeight; y++) {
+    memcpy(pixels + y * bytesPerLine(), source.constScanLine(y), lineSize);
+  }
+  publishFrame();
+  return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "MatrixFrameSource.h"
+
+/// Live frames from another process through a POSIX shared memory ring.
+///
+/// The producer creates the segment with MatrixSharedMemoryWriter, or any
+/// code following the same layout: a Header, then slotCount slots of
+/// slotSize bytes each, starting at offset HeaderSize. Every slot is a Slot
+/// followed by the pixels at offset SlotHeaderSize, RGB888 with
+/// bytesPerLine bytes per line. All atomics are 64 or 32 bit lock-free
+/// integers in host byte order.
+///
+/// A frame is written into a slot that is neither the latest one nor read:
+/// the producer makes the slot's sequence odd, checks that readers is still
+/// zero (backing off otherwise), writes the pixels and writeTimeNs, stores
+/// the new even sequence and finally stores the slot index + 1 in latest.
+/// A reader counts itself in readers and checks that the sequence did not
+/// change meanwhile, so a frame it holds is never overwritten. The player
+/// presents straight out of the slot, the frame is only copied where an
+/// output needs it scaled or converted.
+class MatrixSharedMemorySource : public MatrixFrameSource {
+ public:
+  static const uint32_t Magic = 0x4853584d;  // "MXSH"
+  static const uint32_t Version = 1;
+  static const size_t HeaderSize = 64;
+  static const size_t SlotHeaderSize = 64;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerLine;
+    uint32_t slotCount;
+    uint64_t slotSize;
+    std::atomic<uint32_t> latest;  // slot index + 1, 0 before the first frame
+  };
+
+  struct Slot {
+    std::atomic<uint64_t> sequence;  // 2 * frame number, odd while written
+    std::atomic<int64_t> writeTimeNs;  // steady clock, CLOCK_MONOTONIC
+    std::atomic<uint32_t> readers;  // frames of this slot held by readers
+  };
+
+  MatrixSharedMemorySource();
+  ~MatrixSharedMemorySource() override;
+
+  /// Attach to the segment name ("/name") a producer created.
+  bool open(const std::string& name);
+  /// Frames still held keep the segment mapped until they are released.
+  void close();
+  bool isOpen() const { return mapping != nullptr; }
+
+  int width() const override;
+  int height() const override;
+  bool acquire(Frame& frame) override;
+
+  struct Mapping;
+
+ private:
+  std::shared_ptr<Mapping> mapping;
+};
+
+/// Producer side of MatrixSharedMemorySource, for renderers written against
+/// this code base.
+class MatrixSharedMemoryWriter {
+ public:
+  MatrixSharedMemoryWriter();
+  ~MatrixSharedMemoryWriter();
+
+  /// Create the segment name ("/name"), replacing a stale one. At least
+  /// three slots are needed for the writer to always find a free one while
+  /// the player holds a frame.
+  bool create(const std::string& name, int width, int height,
+              size_t slotCount = 4);
+  /// Unmap and remove the segment, readers attached keep their mapping.
+  void close();
+
+  int width() const;
+  int height() const;
+  size_t bytesPerLine() const;
+
+  /// Pixels of a free slot to render into, nullptr if every slot is held by
+  /// readers. The frame becomes visible with publishFrame().
+  uint8_t* beginFrame();
+  void publishFrame();
+
+  /// Copy frame into a free slot and publish it, false if it was dropped.
+  bool write(const QImage& frame);
+
+ private:
+  std::string name;
+  std::shared_ptr<MatrixSharedMemorySource::Mapping> mapping;
+  uint32_t writingSlot;  // index + 1 of the slot between begin and publish
+  uint64_t frameCount;
+};
@@ -0,0 +1,101 @@
+#include "MatrixTestPatternSource.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+MatrixTestPatternSource::MatrixTestPatternSource(ePattern pattern, int width,
+                                                 int height)
+    : pattern(pattern), width_(width), height_(height) {
+  frameCount = 0;
+  uint64_t pixelCount = uint64_t(max(width, 0)) * uint64_t(max(height, 0));
+  indexBits = 1;
+  while (indexBits < 63 && (uint64_t(1) << indexBits) < pixelCount) {
+    indexBits++;
+  }
+}
+
+bool MatrixTestPatternSource::parsePattern(const std::string& name,
+                                           ePattern& pattern) {
+  if (name == "gradient") {
+    pattern = GRADIENT;
+  } else if (name == "chaser") {
+    pattern = CHASER;
+  } else if (name == "pixel-id") {
+    pattern = PIXEL_ID;
+  } else if (name == "white") {
+    pattern = FULL_WHITE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool MatrixTestPatternSource::acquire(Frame& frame) {
+  if (width_ <= 0 || height_ <= 0) {
+    return false;
+  }
+  // a fresh image every time, the previous one may still be queued at an
+  // output and must not change under it
+  QImage image(width_, height_, QImage::Format_RGB888);
+  render(frameCount, image);
+
+  frame.image = image;
+  frame.sequence = ++frameCount;
+  frame.writeTime = MatrixClock::system().now();
+  return true;
+}
+
+void MatrixTestPatternSource::render(uint64_t frameNumber,
+                                     QImage& image) const {
+  size_t lineSize = 3 * size_t(width_);
+  switch (pattern) {
+    case GRADIENT: {
+      uint8_t blue = uint8_t(frameNumber * 4);
+      for (int y = 0; y < height_; y++) {
+        uint8_t* line = image.scanLine(y);
+        uint8_t green = height_ > 1 ? uint8_t(255 * y / (height_ - 1)) : 0;
+        for (int x = 0; x < width_; x++) {
+          line[3 * x] = width_ > 1 ? uint8_t(255 * x / (width_ - 1)) : 0;
+          line[3 * x + 1] = green;
+          line[3 * x + 2] = blue;
+        }
+      }
+      break;
+    }
+    case CHASER: {
+      for (int y = 0; y < height_; y++) {
+        memset(image.scanLine(y), 0, lineSize);
+      }
+      uint64_t pixel = frameNumber % (uint64_t(width_) * height_);
+      memset(image.scanLine(int(pixel / width_)) + 3 * (pixel % width_), 255,
+             3);
+      break;
+    }
+    case PIXEL_ID: {
+      int bit = int(frameNumber % pixelIdCycle()) - 1;
+      for (int y = 0; y < height_; y++) {
+        uint8_t* line = image.scanLine(y);
+        if (bit < 0) {
+          // sync frame, marks where the bits start
+          memset(line, 0, lineSize);
+          for (int x = 0; x < width_; x++) {
+            line[3 * x] = 255;
+          }
+          continue;
+        }
+        for (int x = 0; x < width_; x++) {
+          uint64_t index = uint64_t(y) * width_ + x;
+          memset(&line[3 * x], (index >> bit) & 1 ? 255 : 0, 3);
+        }
+      }
+      break;
+    }
+    case FULL_WHITE:
+      for (int y = 0; y < height_; y++) {
+        memset(image.scanLine(y), 255, lineSize);
+      }
+      break;
+  }
+}
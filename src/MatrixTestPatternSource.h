@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#include "MatrixFrameSource.h"
+
+/// Test patterns computed on the fly, one new frame per acquire(), so they
+/// run at whatever geometry and frame rate the player is given without a
+/// frame ever being stored. Used for load tests of the outputs and the
+/// network and for commissioning the facade without preparing any files.
+class MatrixTestPatternSource : public MatrixFrameSource {
+ public:
+  enum ePattern {
+    GRADIENT,    // red across, green down, blue cycling with time
+    CHASER,      // one white pixel walking row by row, one pixel per frame
+    PIXEL_ID,    // every pixel blinks its row major index, see below
+    FULL_WHITE,  // every channel at full, the worst case power draw
+  };
+
+  MatrixTestPatternSource(ePattern pattern, int width, int height);
+
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  bool acquire(Frame& frame) override;
+
+  /// PIXEL_ID repeats every this many frames: an all red sync frame, then
+  /// the bits of each pixel's index, least significant first, white for a
+  /// one and black for a zero. Only needs on and off to survive any color
+  /// depth, a camera on the facade can tell every pixel's position.
+  int pixelIdCycle() const { return 1 + indexBits; }
+
+  static bool parsePattern(const std::string& name, ePattern& pattern);
+
+ private:
+  void render(uint64_t frameNumber, QImage& image) const;
+
+  ePattern pattern;
+  int width_, height_;
+  int indexBits;  // bits of the largest pixel index
+  uint64_t frameCount;
+};
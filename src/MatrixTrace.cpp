@@ -0,0 +1,182 @@
+#include "MatrixTrace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+struct Event {
+  const char* category;
+  const char* name;
+  int64_t startNs;
+  int64_t durationNs;
+};
+
+// Events are kept in chunks of this many, an append allocates at most one
+// fresh chunk and never moves what was recorded
+const size_t ChunkSize = 4096;
+
+// Written by its thread only. The mutex is only ever contended by start()
+// and writeJson(), never by two recording threads.
+struct ThreadBuffer {
+  mutex mtx;
+  vector<unique_ptr<Event[]>> chunks;
+  size_t numEvents = 0;
+  uint32_t id;
+  string name;
+  bool isExited = false;  // its thread is gone, dropped by the next start()
+};
+
+atomic_bool recording{false};
+atomic<int64_t> epochNs{0};
+
+// buffers outlive their threads until the next recording starts, so a
+// trace still shows threads that exited while it ran
+mutex registryMutex;
+vector<shared_ptr<ThreadBuffer>> buffers;
+uint32_t nextThreadId = 1;
+
+int64_t nowNs() {
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// registers the buffer of a thread and flags it when the thread exits
+struct Registration {
+  shared_ptr<ThreadBuffer> buffer;
+
+  Registration() : buffer(make_shared<ThreadBuffer>()) {
+    lock_guard<mutex> lk(registryMutex);
+    // threads come and go with every load, forget the ones with nothing
+    // left to show
+    vector<shared_ptr<ThreadBuffer>> kept;
+    for (auto& other : buffers) {
+      lock_guard<mutex> bufferLock(other->mtx);
+      if (!other->isExited || other->numEvents > 0) {
+        kept.push_back(other);
+      }
+    }
+    buffers.swap(kept);
+    buffer->id = nextThreadId++;
+    buffers.push_back(buffer);
+  }
+
+  ~Registration() {
+    lock_guard<mutex> lk(buffer->mtx);
+    buffer->isExited = true;
+  }
+};
+
+ThreadBuffer& threadBuffer() {
+  thread_local Registration registration;
+  return *registration.buffer;
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// Recording
+
+void MatrixTrace::start() {
+  lock_guard<mutex> lk(registryMutex);
+  vector<shared_ptr<ThreadBuffer>> kept;
+  for (auto& buffer : buffers) {
+    lock_guard<mutex> bufferLock(buffer->mtx);
+    buffer->chunks.clear();
+    buffer->numEvents = 0;
+    if (!buffer->isExited) {
+      kept.push_back(buffer);
+    }
+  }
+  buffers.swap(kept);
+  epochNs = nowNs();
+  recording = true;
+}
+
+void MatrixTrace::stop() { recording = false; }
+
+bool MatrixTrace::isRecording() {
+  return recording.load(memory_order_relaxed);
+}
+
+void MatrixTrace::setThreadName(const char* name) {
+  ThreadBuffer& buffer = threadBuffer();
+  lock_guard<mutex> lk(buffer.mtx);
+  buffer.name = name;
+}
+
+MatrixTrace::Scope::Scope(const char* category, const char* name)
+    : category(category), name(name) {
+  startNs = isRecording() ? nowNs() : -1;
+}
+
+MatrixTrace::Scope::~Scope() {
+  if (startNs < 0) {
+    return;
+  }
+  int64_t endNs = nowNs();
+  ThreadBuffer& buffer = threadBuffer();
+  lock_guard<mutex> lk(buffer.mtx);
+  if (buffer.numEvents >= MaxEventsPerThread) {
+    return;
+  }
+  size_t offset = buffer.numEvents % ChunkSize;
+  if (offset == 0) {
+    buffer.chunks.emplace_back(new Event[ChunkSize]);
+  }
+  buffer.chunks.back()[offset] = {category, name, startNs, endNs - startNs};
+  buffer.numEvents++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Export
+
+bool MatrixTrace::writeJson(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    cout << "Could not open trace file " << path << endl;
+    return false;
+  }
+
+  // names are literals and thread names our own, nothing needs escaping
+  int64_t epoch = epochNs;
+  const char* separator = "";
+  fprintf(file, "{\"traceEvents\":[");
+  lock_guard<mutex> lk(registryMutex);
+  for (auto& buffer : buffers) {
+    lock_guard<mutex> bufferLock(buffer->mtx);
+    if (!buffer->name.empty()) {
+      fprintf(file,
+              "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+              separator, buffer->id, buffer->name.c_str());
+      separator = ",";
+    }
+    for (size_t i = 0; i < buffer->numEvents; i++) {
+      const Event& event = buffer->chunks[i / ChunkSize][i % ChunkSize];
+      // timestamps in microseconds, kept to the nanosecond
+      fprintf(file,
+              "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+              "\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+              separator, event.name, event.category,
+              (event.startNs - epoch) / 1000.0, event.durationNs / 1000.0,
+              buffer->id);
+      separator = ",";
+    }
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  bool isWritten = !ferror(file);
+  isWritten = fclose(file) == 0 && isWritten;
+  if (!isWritten) {
+    cout << "Could not write trace file " << path << endl;
+  }
+  return isWritten;
+}
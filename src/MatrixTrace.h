@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/// Records where the time goes across threads as Chrome trace events, to
+/// be opened in chrome://tracing or ui.perfetto.dev.
+///
+/// Code is instrumented with MATRIX_TRACE_SCOPE, which times the rest of
+/// the enclosing block. The macros compile to nothing unless the build
+/// defines MATRIXSOURCE_TRACE. Compiled in, a scope costs a relaxed atomic
+/// load while not recording, and two clock reads and an append to a buffer
+/// of the calling thread while recording.
+class MatrixTrace {
+ public:
+#ifdef MATRIXSOURCE_TRACE
+  static constexpr bool IsCompiledIn = true;
+#else
+  static constexpr bool IsCompiledIn = false;
+#endif
+
+  /// Each thread keeps at most this many events, later ones are dropped.
+  /// They are allocated in small chunks as they come.
+  static const size_t MaxEventsPerThread = 1 << 20;
+
+  /// Start recording, events of a previous recording are dropped.
+  static void start();
+  static void stop();
+  static bool isRecording();
+
+  /// Write what was recorded so far in the Chrome trace event format.
+  static bool writeJson(const std::string& path);
+
+  /// Shown instead of the thread id of the calling thread.
+  static void setThreadName(const char* name);
+
+  /// One complete event from construction to destruction. Names and
+  /// categories must be string literals, only their pointers are kept.
+  class Scope {
+   public:
+    Scope(const char* category, const char* name);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const char* category;
+    const char* name;
+    int64_t startNs;  // negative if not recording
+  };
+};
+
+#ifdef MATRIXSOURCE_TRACE
+#define MATRIX_TRACE_CONCAT_(a, b) a##b
+#define MATRIX_TRACE_CONCAT(a, b) MATRIX_TRACE_CONCAT_(a, b)
+#define MATRIX_TRACE_SCOPE(category, name)                         \
+  MatrixTrace::Scope MATRIX_TRACE_CONCAT(matrixTraceScope, __LINE__)( \
+      category, name)
+#define MATRIX_TRACE_THREAD_NAME(name) MatrixTrace::setThreadName(name)
+#else
+#define MATRIX_TRACE_SCOPE(category, name) ((void)0)
+#define MATRIX_TRACE_THREAD_NAME(name) ((void)0)
+#endif
@@ -0,0 +1,134 @@
+#include "MatrixUdpSender.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+#ifdef _WIN32
+static const intptr_t InvalidSocket = (intptr_t)INVALID_SOCKET;
+#else
+static const intptr_t InvalidSocket = -1;
+#endif
+
+MatrixUdpSender::MatrixUdpSender(const MatrixWireFormat& format)
+    : format(format) {
+  socketFd = InvalidSocket;
+  targetAddress = 0;
+
+  size_t offset = 0;
+  for (int packet = 0; packet < format.packetCount(); packet++) {
+    datagramOffsets.push_back(offset);
+    offset += format.datagramSize(packet);
+  }
+}
+
+MatrixUdpSender::~MatrixUdpSender() { close(); }
+
+bool MatrixUdpSender::open(const std::string& address) {
+  close();
+
+#ifdef _WIN32
+  static bool isWinsockReady = [] {
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  if (!isWinsockReady) {
+    return false;
+  }
+#endif
+
+  in_addr target;
+  if (inet_pton(AF_INET, address.c_str(), &target) != 1) {
+    cout << "Invalid target address " << address << endl;
+    return false;
+  }
+  targetAddress = target.s_addr;
+
+  socketFd = (intptr_t)socket(AF_INET, SOCK_DGRAM, 0);
+  if (socketFd == InvalidSocket) {
+    cout << "Failed to create UDP socket: " << strerror(errno) << endl;
+    return false;
+  }
+
+  int enable = 1;
+  setsockopt(socketFd, SOL_SOCKET, SO_BROADCAST, (const char*)&enable,
+             sizeof(enable));
+  return true;
+}
+
+void MatrixUdpSender::close() {
+  if (socketFd == InvalidSocket) {
+    return;
+  }
+#ifdef _WIN32
+  closesocket(socketFd);
+#else
+  ::close(socketFd);
+#endif
+  socketFd = InvalidSocket;
+}
+
+bool MatrixUdpSender::sendFrame(const uint8_t* frame) {
+  if (socketFd == InvalidSocket) {
+    return false;
+  }
+
+  sockaddr_in target;
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(format.port);
+  target.sin_addr.s_addr = targetAddress;
+
+  int numPackets = format.packetCount();
+
+#ifdef __linux__
+  // a frame is at most 256 datagrams
+  iovec vectors[256];
+  mmsghdr messages[256];
+  memset(messages, 0, sizeof(mmsghdr) * numPackets);
+  for (int packet = 0; packet < numPackets; packet++) {
+    vectors[packet].iov_base = (void*)(frame + datagramOffsets[packet]);
+    vectors[packet].iov_len = format.datagramSize(packet);
+    messages[packet].msg_hdr.msg_name = &target;
+    messages[packet].msg_hdr.msg_namelen = sizeof(target);
+    messages[packet].msg_hdr.msg_iov = &vectors[packet];
+    messages[packet].msg_hdr.msg_iovlen = 1;
+  }
+
+  int sent = 0;
+  while (sent < numPackets) {
+    int result = sendmmsg(socketFd, messages + sent, numPackets - sent, 0);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += result;
+  }
+  return true;
+#else
+  bool isSent = true;
+  for (int packet = 0; packet < numPackets; packet++) {
+    size_t size = format.datagramSize(packet);
+    if (sendto(socketFd, (const char*)(frame + datagramOffsets[packet]),
+               (int)size, 0, (const sockaddr*)&target,
+               sizeof(target)) != (intptr_t)size) {
+      isSent = false;
+    }
+  }
+  return isSent;
+#endif
+}
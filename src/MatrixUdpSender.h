@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MatrixWireFormat.h"
+
+/// Sends frames that are already in MUEB wire format.
+///
+/// The counterpart of MatrixWireFormat::encode: the hot path is one system
+/// call per frame (sendmmsg where available) on buffers built in advance, no
+/// conversion and no allocation.
+class MatrixUdpSender {
+ public:
+  MatrixUdpSender(const MatrixWireFormat& format);
+  ~MatrixUdpSender();
+
+  /// Target address, broadcast addresses are allowed. The port is taken
+  /// from the wire format.
+  bool open(const std::string& address);
+  void close();
+  bool isOpen() const { return socketFd >= 0; }
+
+  const MatrixWireFormat& getFormat() const { return format; }
+
+  /// Send the frameSize() bytes at frame as packetCount() datagrams.
+  bool sendFrame(const uint8_t* frame);
+
+ private:
+  MatrixWireFormat format;
+  std::vector<size_t> datagramOffsets;
+  intptr_t socketFd;
+  uint32_t targetAddress;  // IPv4, network byte order
+};
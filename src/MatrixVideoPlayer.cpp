@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "MatrixTrace.h"
 #include "Q4XLoader.h"
 
 using namespace std;
@@ -10,62 +11,269 @@ using namespace std::chrono;
 ////////////////////////////////////////////////////////////////////////////////
 // Ctor
 
-MatrixVideoPlayer::MatrixVideoPlayer() { state = EMPTY; }
+MatrixVideoPlayer::MatrixVideoPlayer(MatrixReactor* reactor) {
+  state = EMPTY;
+  frameTimer = 0;
+  if (!reactor) {
+    ownReactor = make_unique<MatrixReactor>();
+    reactor = ownReactor.get();
+  }
+  this->reactor = reactor;
+}
 
-MatrixVideoPlayer::~MatrixVideoPlayer() { stop(); }
+MatrixVideoPlayer::~MatrixVideoPlayer() {
+  stop();
+  // seeks and syncs still queued on a shared reactor point at this player
+  reactor->flush();
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Playback control
 
-void MatrixVideoPlayer::play() {
+void MatrixVideoPlayer::play() { playAt(clock->now()); }
+
+void MatrixVideoPlayer::playAt(MatrixClock::time_point start) {
   if (state == EMPTY) {
     return;
   } else if (state == STOPPED) {
-    controlTaskQueue = decltype(controlTaskQueue)();  // clear...
-    state = PLAYING;
-    currentFrame = 0;
-    targetTimeDelta = microseconds(0);
-
-    // start display thread
-    if (displayThread.joinable()) {
-      displayThread.join();
+    {
+      lock_guard<mutex> lk(mtx);
+      state = PLAYING;
+      currentFrame = 0;
+      presentedFrame = 0;
+      targetTimeDelta = microseconds(0);
+      deltaCompensation = microseconds(0);
+      lastTime = start;
+      scheduleFrame(lastTime + frameTime);
+      publishSnapshot();
     }
-    displayThread = thread([this] { displayThreadFunc(); });
     notifyListenersState(state);
+    notifyListenersTime(0);
   } else if (state == PAUSED) {
-    targetTimeDelta = microseconds(0);
-    state = PLAYING;
+    MatrixReactor::TimerId refreshTimer;
+    {
+      lock_guard<mutex> lk(mtx);
+      if (state != PAUSED) {
+        return;
+      }
+      targetTimeDelta = microseconds(0);
+      state = PLAYING;
+      scrubbing = false;
+      // pick up the interrupted frame where it was left
+      auto pausedFor = start - pausedAt;
+      lastTime += pausedFor;
+      refreshTimer = frameTimer;
+      scheduleFrame(frameDeadline + pausedFor);
+      publishSnapshot();
+    }
+    reactor->cancel(refreshTimer);
     notifyListenersState(state);
   }
 }
 
 void MatrixVideoPlayer::pause() {
-  targetTimeDelta = microseconds(0);
-  state = PAUSED;
+  MatrixReactor::TimerId timer;
+  {
+    lock_guard<mutex> lk(mtx);
+    if (state != PLAYING) {
+      return;
+    }
+    targetTimeDelta = microseconds(0);
+    state = PAUSED;
+    pausedAt = clock->now();
+    publishSnapshot();
+
+    // nothing runs until the next command, apart from the refresh
+    timer = frameTimer;
+    frameTimer = 0;
+    microseconds refreshInterval = pausedRefreshInterval;
+    if (refreshInterval > microseconds(0)) {
+      frameTimer = reactor->schedulePeriodic(refreshInterval,
+                                             [this] { refreshFrame(); });
+    }
+  }
+  // outside the lock, a frame being presented right now needs it to finish
+  reactor->cancel(timer);
   notifyListenersState(state);
 }
 
 void MatrixVideoPlayer::stop() {
-  // kill display thread
-  state = STOPPED;
+  MatrixReactor::TimerId timer;
+  {
+    lock_guard<mutex> lk(mtx);
+    state = STOPPED;
+    scrubbing = false;
+    timer = frameTimer;
+    frameTimer = 0;
+    publishSnapshot();
+  }
   notifyListenersState(state);
-  if (displayThread.joinable()) {
-    displayThread.join();
+  // outside the lock, a frame being presented right now needs it to finish
+  reactor->cancel(timer);
+}
+
+void MatrixVideoPlayer::setClock(MatrixClock* clock) {
+  this->clock = clock;
+  if (ownReactor) {
+    ownReactor->setClock(clock);
+  }
+}
+
+void MatrixVideoPlayer::seek(std::chrono::microseconds time,
+                             MatrixClock::time_point start) {
+  if (state != PLAYING && state != PAUSED) {
+    return;
+  }
+  auto enqueued = clock->now();
+  reactor->post([this, time, start, enqueued] {
+    unique_lock<mutex> lk(mtx);
+    if (state != PLAYING && state != PAUSED) {
+      return;
+    }
+    auto now = clock->now();
+    if (metrics) {
+      metrics->controlLatency.record(now - enqueued);
+    }
+
+    // compute required frame index and align playtime with next frame
+    size_t frameDesired = size_t(time.count() / frameTime.count());
+    microseconds timeOvershoot = time - frameDesired * frameTime;
+    if (frameDesired >= frames.size()) {
+      return;
+    }
+    if (state == PAUSED) {
+      // show where we are once, then stay parked
+      parkAt(frameDesired, timeOvershoot);
+      return;
+    }
+    auto anchor = start == MatrixClock::time_point() ? now : start;
+    currentFrame = frameDesired;
+    targetTimeDelta = microseconds(0);
+    deltaCompensation = microseconds(0);
+    lastTime = anchor - timeOvershoot;
+    reactor->cancel(frameTimer);
+    scheduleFrame(anchor + frameTime - timeOvershoot);
+    publishSnapshot();
+    // the time of the next frame, not of the one before the seek
+    double frameStart = (frameTime * currentFrame).count() / 1.0e6;
+    lk.unlock();
+    notifyListenersTime(frameStart);
+  });
+}
+
+void MatrixVideoPlayer::beginScrub() {
+  MatrixReactor::TimerId refreshTimer;
+  {
+    lock_guard<mutex> lk(mtx);
+    if (state != PAUSED || liveSource || scrubbing) {
+      return;
+    }
+    scrubbing = true;
+    scrubTarget = presentedFrame * frameTime;
+    refreshTimer = frameTimer;
+    // the frame tick is the rate limit, a burst of scrubTo() calls between
+    // two ticks costs one present
+    frameTimer = reactor->schedulePeriodic(frameTime, [this] { scrubFrame(); });
   }
+  reactor->cancel(refreshTimer);
+}
+
+void MatrixVideoPlayer::endScrub() {
+  MatrixReactor::TimerId scrubTimer;
+  {
+    lock_guard<mutex> lk(mtx);
+    if (!scrubbing) {
+      return;
+    }
+    showScrubTarget();
+    scrubbing = false;
+    scrubTimer = frameTimer;
+    frameTimer = 0;
+    microseconds refreshInterval = pausedRefreshInterval;
+    if (refreshInterval > microseconds(0)) {
+      frameTimer = reactor->schedulePeriodic(refreshInterval,
+                                             [this] { refreshFrame(); });
+    }
+  }
+  reactor->cancel(scrubTimer);
+}
+
+void MatrixVideoPlayer::alignTimeline(MatrixClock::time_point origin) {
+  if (state != PLAYING) {
+    return;
+  }
+  auto enqueued = clock->now();
+  reactor->post([this, origin, enqueued] {
+    lock_guard<mutex> lk(mtx);
+    if (state != PLAYING) {
+      return;
+    }
+    auto now = clock->now();
+    if (metrics) {
+      metrics->controlLatency.record(now - enqueued);
+    }
+
+    // the frame due next on that timeline, derived from origin alone
+    size_t frameDesired = 0;
+    if (now > origin) {
+      frameDesired = size_t((now - origin) / frameTime);
+    }
+    if (!liveSource && frameDesired >= frames.size()) {
+      return;
+    }
+    currentFrame = frameDesired;
+    targetTimeDelta = microseconds(0);
+    deltaCompensation = microseconds(0);
+    lastTime = origin + frameDesired * frameTime;
+    reactor->cancel(frameTimer);
+    scheduleFrame(lastTime + frameTime);
+    publishSnapshot();
+  });
+}
+
+void MatrixVideoPlayer::sync(std::chrono::microseconds externalTime) {
+  if (state != PLAYING && state != PAUSED) {
+    return;
+  }
+  auto enqueued = clock->now();
+  reactor->post([this, externalTime, enqueued] {
+    lock_guard<mutex> lk(mtx);
+    if (state != PLAYING && state != PAUSED) {
+      return;
+    }
+    auto now = clock->now();
+    if (metrics) {
+      metrics->controlLatency.record(now - enqueued);
+    }
+
+    // compute difference from external time, the clock stands while paused
+    auto frameElapsed = (state == PAUSED ? pausedAt : now) - lastTime;
+    microseconds currentTime = currentFrame * frameTime +
+                               duration_cast<microseconds>(frameElapsed);
+    targetTimeDelta = externalTime - currentTime;
+    if (metrics) {
+      metrics->avOffset.record(targetTimeDelta);
+    }
+  });
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Get state
 
 std::chrono::microseconds MatrixVideoPlayer::getTime() const {
-  switch (+state) {
-    case PAUSED:
-    case PLAYING:
-      return currentFrame * frameTime;
-    case EMPTY:
-    case STOPPED:
-      return microseconds(0);
+  return snapshot.load().positionAt(clock->now());
+}
+
+auto MatrixVideoPlayer::Snapshot::positionAt(MatrixClock::time_point now) const
+    -> microseconds {
+  if (rate == 0 || now <= anchorTime) {
+    return position;
   }
+  auto elapsed = duration_cast<microseconds>((now - anchorTime) * rate);
+  if (duration == microseconds(0)) {
+    return position + elapsed;  // live, runs on for as long as it plays
+  }
+  return min(position + elapsed, duration);
 }
 
 auto MatrixVideoPlayer::getState() const -> eState { return state; }
@@ -108,7 +316,9 @@ bool MatrixVideoPlayer::load(const QImage* frames, size_t numFrames,
     this->frames.resize(numFrames);
     this->frames.assign(frames, frames + numFrames);
 
+    lock_guard<mutex> lk(mtx);
     state = STOPPED;
+    publishSnapshot();
 
     return true;
   } else {
@@ -116,154 +326,224 @@ bool MatrixVideoPlayer::load(const QImage* frames, size_t numFrames,
   }
 }
 
+bool MatrixVideoPlayer::loadLive(MatrixFrameSource* source,
+                                 std::chrono::microseconds frameTime) {
+  clear();
+  if (!source || source->width() <= 0 || source->height() <= 0) {
+    return false;
+  }
+  width_ = source->width();
+  height_ = source->height();
+  this->frameTime = frameTime;
+
+  lock_guard<mutex> lk(mtx);
+  liveSource = source;
+  state = STOPPED;
+  publishSnapshot();
+  return true;
+}
+
 void MatrixVideoPlayer::clear() {
   stop();
-  frames.clear();
-  state = EMPTY;
+  {
+    lock_guard<mutex> lk(mtx);
+    frames.clear();
+    liveSource = nullptr;
+    liveFrame = MatrixFrameSource::Frame();
+    state = EMPTY;
+    publishSnapshot();
+  }
   notifyListenersState(state);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Internal stuff
 
-void MatrixVideoPlayer::displayThreadFunc() {
-  microseconds compensation(0);
-  microseconds waitTime;
-  auto lastTime = high_resolution_clock::now();
-  microseconds deltaCompensation(0);
-
-  while (state == PAUSED || state == PLAYING) {
-    notifyListenersTime((frameTime * currentFrame).count() / 1.0e6);
-    waitTime = frameTime - compensation;
-    waitTime -= deltaCompensation;
-
-    cout << "wait time = " << waitTime.count() / 1000.0f << " ms" << endl;
-    cout << "delta     = " << targetTimeDelta.count() / 1000.0f << " ms"
-         << endl;
-    cout << "delta comp= " << deltaCompensation.count() / 1000.0f << " ms"
-         << endl;
-
-    // lock that mutex lel
-    unique_lock<mutex> lk(mtx);
+void MatrixVideoPlayer::presentFrame() {
+  MATRIX_TRACE_SCOPE("video", "presentFrame");
+  unique_lock<mutex> lk(mtx);
+  if (state != PLAYING) {
+    return;
+  }
 
-    bool isExtraTask = cv.wait_for(
-        lk, waitTime, [this] { return controlTaskQueue.size() > 0; });
-    if (isExtraTask) {
-      // calculate time of waiting until this task was received
-      auto now = high_resolution_clock::now();
-      microseconds elapsedPartial = duration_cast<microseconds>(now - lastTime);
-
-      // perform that extra task
-      // extra tasks can be:
-      // - new media time
-      // - new target delta
-      // - super accurate query for media time
-      // if the task returns false, interrupt this frame and immediately start
-      // new
-      auto task = std::move(controlTaskQueue.front());
-      controlTaskQueue.pop();
-      if (!task(elapsedPartial)) {
-        compensation = microseconds(0);
-        lastTime = high_resolution_clock::now();
-        continue;
-      } else {
-        compensation += elapsedPartial;
-        continue;
-      }
-    } else {
-      compensation = microseconds(0);
-      // TODO: display every second frame!
-      // dummy display code
-      if (state == PAUSED) {
-        cout << "Displaying paused frame " << currentFrame << endl;
-        if (PresentFrame) {
-          PresentFrame(frames[currentFrame]);
-        }
-        notifyListenersFrame(frames[currentFrame]);
-      } else {
-        cout << "Displaying running frame " << currentFrame << endl;
-        if (PresentFrame) {
-          PresentFrame(frames[currentFrame]);
-        }
-        notifyListenersFrame(frames[currentFrame]);
-        currentFrame++;
-      }
+  auto presentStart = clock->now();
+  const QImage* frame = nullptr;
+  if (!liveSource) {
+    frame = &frames[currentFrame];
+  } else {
+    // nothing to show until the producer has finished its first frame
+    uint64_t previousSequence = liveFrame.sequence;
+    if (liveSource->acquire(liveFrame) &&
+        liveFrame.sequence != previousSequence && metrics) {
+      metrics->liveLatency.record(presentStart - liveFrame.writeTime);
+    }
+    frame = liveFrame.image.isNull() ? nullptr : &liveFrame.image;
+  }
+  if (frame) {
+    presentedFrame = currentFrame;
+    if (PresentFrame) {
+      MATRIX_TRACE_SCOPE("video", "PresentFrame");
+      PresentFrame(currentFrame, *frame);
     }
+    if (metrics) {
+      metrics->frameLateness.record(presentStart - frameDeadline);
+      metrics->presentDuration.record(clock->now() - presentStart);
+    }
+    notifyListenersFrame(*frame);
+  }
+  currentFrame++;
+
+  auto now = clock->now();
+  if (metrics) {
+    metrics->frameInterval.record(now - lastTime);
+    metrics->updateThreadCpu(MatrixMetrics::REACTOR_THREAD);
+  }
+  lastTime = now;
 
+  if (!liveSource && currentFrame == frames.size()) {
+    state = STOPPED;
+    publishSnapshot();
     lk.unlock();
+    notifyListenersTrackEnd();
+    notifyListenersState(STOPPED);
+    return;
+  }
 
-    auto now = high_resolution_clock::now();
-    auto elapsed = duration_cast<microseconds>(now - lastTime);
-    cout << "Actual frametime: " << elapsed.count() / 1000.0 << " ms" << endl;
-    lastTime = now;
+  // converge to external source
+  long long deltaUs = targetTimeDelta.count();
+  long long frameUs = (deltaUs < 0 ? -1 : 1) * frameTime.count();
+  long long deltaCompensationUs;
+  deltaUs *= 0.1;
+  frameUs *= 0.1;
+  if (abs(deltaUs) < abs(frameUs))
+    deltaCompensationUs = deltaUs;
+  else {
+    deltaCompensationUs = frameUs;
+  }
+  deltaCompensation = microseconds(deltaCompensationUs);
+  targetTimeDelta -= deltaCompensation;
 
-    if (currentFrame == frames.size()) {
-      state = STOPPED;
-      notifyListenersTrackEnd();
-      notifyListenersState(state);
-    }
+  // deadlines are absolute, time spent presenting does not add up to drift
+  frameDeadline += frameTime - deltaCompensation;
+  if (frameDeadline < now - frameTime) {
+    frameDeadline = now;  // stalled, do not catch up in a burst of frames
+  }
+  scheduleFrame(frameDeadline);
+  publishSnapshot();
+  double time = (frameTime * currentFrame).count() / 1.0e6;
+  lk.unlock();
+  notifyListenersTime(time);
+}
 
-    // converge to external source
-    long long deltaUs = targetTimeDelta.count();
-    long long frameUs = (deltaUs < 0 ? -1 : 1) * frameTime.count();
-    long long deltaCompensationUs;
-    deltaUs *= 0.1;
-    frameUs *= 0.1;
-    if (abs(deltaUs) < abs(frameUs))
-      deltaCompensationUs = deltaUs;
-    else {
-      deltaCompensationUs = frameUs;
-    }
-    deltaCompensation = microseconds(deltaCompensationUs);
-    targetTimeDelta -= deltaCompensation;
+void MatrixVideoPlayer::parkAt(size_t frame,
+                               std::chrono::microseconds overshoot) {
+  auto now = clock->now();
+  currentFrame = frame;
+  targetTimeDelta = microseconds(0);
+  deltaCompensation = microseconds(0);
+  lastTime = now - overshoot;
+  pausedAt = now;
+  frameDeadline = now + frameTime - overshoot;
+  presentedFrame = currentFrame;
+  if (PresentFrame) {
+    PresentFrame(currentFrame, frames[currentFrame]);
   }
+  // listeners get the parked frame's time before the frame, as when playing
+  notifyListenersTime((frameTime * currentFrame).count() / 1.0e6);
+  notifyListenersFrame(frames[currentFrame]);
+  publishSnapshot();
 }
 
-bool MatrixVideoPlayer::debugLoad(size_t numFrames) {
-  clear();
+void MatrixVideoPlayer::scrubFrame() {
+  lock_guard<mutex> lk(mtx);
+  if (state == PAUSED && scrubbing) {
+    showScrubTarget();
+  }
+}
 
-  return false;
-  /*
-  frames.resize(numFrames);
-  for (size_t i=0; i<frames.size(); ++i) {
-      frames[i].id = i;
-      frames[i].pixels.resize(36*24, RGB(0,0,0));
-      for (size_t y = 0; y<36; y++) {
-          for (size_t x = 0; x < i % 24; x++) {
-              frames[i].pixels(y*24 + x) = RGB(1,1,1);
-          }
-      }
+void MatrixVideoPlayer::showScrubTarget() {
+  // a plain index computation, frames are evenly spaced
+  microseconds time = max(scrubTarget.load(), microseconds(0));
+  size_t frame = size_t(time / frameTime);
+  if (frame >= frames.size()) {
+    frame = frames.size() - 1;
+    time = frame * frameTime;
   }
-  frameTime = microseconds(33333); // 33.333 ms
-  state = STOPPED;
-  notifyListenersState(state);
-  return true;
-  */
+  if (frame == presentedFrame && frame == currentFrame) {
+    return;  // already shown, the outputs need not see it again
+  }
+  parkAt(frame, time - frame * frameTime);
+}
+
+void MatrixVideoPlayer::refreshFrame() {
+  lock_guard<mutex> lk(mtx);
+  if (state != PAUSED || !PresentFrame) {
+    return;
+  }
+  if (!liveSource) {
+    PresentFrame(presentedFrame, frames[presentedFrame]);
+  } else if (!liveFrame.image.isNull()) {
+    PresentFrame(presentedFrame, liveFrame.image);
+  }
+}
+
+void MatrixVideoPlayer::scheduleFrame(MatrixClock::time_point deadline) {
+  frameDeadline = deadline;
+  frameTimer = reactor->schedule(deadline, [this] { presentFrame(); });
 }
 
-void MatrixVideoPlayer::debugSetFrameTime(double timeSec) {
-  frameTime = microseconds((size_t)(timeSec * 1e+6));
+void MatrixVideoPlayer::publishSnapshot() {
+  Snapshot published;
+  published.state = state;
+  published.anchorTime = clock->now();
+  if (state == PLAYING && published.anchorTime < lastTime) {
+    published.anchorTime = lastTime;  // started at a time still to come
+  }
+  if (state == PLAYING || state == PAUSED) {
+    auto frameElapsed =
+        (state == PAUSED ? pausedAt : published.anchorTime) - lastTime;
+    published.position =
+        currentFrame * frameTime + duration_cast<microseconds>(frameElapsed);
+    published.position = max(published.position, microseconds(0));
+  }
+  if (state == PLAYING) {
+    // the next frame is due when media time reaches its index + 1
+    published.origin = frameDeadline - (currentFrame + 1) * frameTime;
+    // runs faster or slower while converging to the external source
+    auto frameInterval = frameDeadline - lastTime;
+    published.rate = frameInterval > frameInterval.zero()
+                         ? duration<double>(frameTime) / frameInterval
+                         : 1.0;
+  }
+  if (state != EMPTY) {
+    published.duration = frameTime * (intptr_t)frames.size();
+  }
+  snapshot.store(published);
 }
 
 void MatrixVideoPlayer::notifyListenersState(eState state) {
+  MATRIX_TRACE_SCOPE("listeners", "onStateChanged");
   for (auto listener : listeners) {
     listener->onStateChanged(state);
   }
 }
 
 void MatrixVideoPlayer::notifyListenersTime(double time) {
+  MATRIX_TRACE_SCOPE("listeners", "onTimeChanged");
   for (auto listener : listeners) {
     listener->onTimeChanged(time);
   }
 }
 
 void MatrixVideoPlayer::notifyListenersTrackEnd() {
+  MATRIX_TRACE_SCOPE("listeners", "onTrackEnded");
   for (auto listener : listeners) {
     listener->onTrackEnded();
   }
 }
 
 void MatrixVideoPlayer::notifyListenersFrame(const QImage& frame) {
+  MATRIX_TRACE_SCOPE("listeners", "onFrameChanged");
   for (auto listener : listeners) {
     listener->onFrameChanged(frame);
   }
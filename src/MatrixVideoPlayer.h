@@ -4,14 +4,18 @@
 #include <QImage>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <set>
 #include <string>
-#include <thread>
+
+#include "MatrixClock.h"
+#include "MatrixFrameSource.h"
+#include "MatrixMetrics.h"
+#include "MatrixReactor.h"
+#include "MatrixSeqlock.h"
 
 class MatrixVideoPlayerListener;
 
@@ -24,27 +28,71 @@ class MatrixVideoPlayer {
     PLAYING,
   };
 
-  MatrixVideoPlayer();
+  /// Frames are timed on reactor, which must outlive the player. Without
+  /// one the player runs a reactor of its own.
+  explicit MatrixVideoPlayer(MatrixReactor* reactor = nullptr);
   ~MatrixVideoPlayer();
 
   // --- Playback control --- //
 
   /// Start playing set media.
   void play();
+  /// Start or resume so that media time runs on from start, a clock time
+  /// that may lie slightly in the future. Nothing is presented before it.
+  void playAt(MatrixClock::time_point start);
   void pause();
   void stop();
 
   template <class Rep, class Period>
   void setTime(std::chrono::duration<Rep, Period> time);
+  /// Seek so that media time runs on from time at clock time start, e.g.
+  /// the instant just passed to playAt(), rather than from when the seek
+  /// runs. Only while playing.
+  void setTimeAt(std::chrono::microseconds time,
+                 MatrixClock::time_point start) {
+    seek(time, start);
+  }
   template <class Rep, class Period>
   void syncToExternalSource(std::chrono::duration<Rep, Period> externalTime);
+  /// Jump to where a timeline starting at clock time origin is now, frame
+  /// deadlines land exactly on origin + k * frameTime no matter how late the
+  /// jump runs. Only while playing.
+  void alignTimeline(MatrixClock::time_point origin);
+
+  /// Scrub through a paused track: the frame at the time last passed to
+  /// scrubTo() is presented on the next frame tick, at most one frame per
+  /// frameTime no matter how often it is called. scrubTo() only stores the
+  /// time, so a slider can call it on every move without seeks queueing up.
+  /// endScrub() shows the final time and stays paused there.
+  void beginScrub();
+  void scrubTo(std::chrono::microseconds time) { scrubTarget = time; }
+  void endScrub();
+  bool isScrubbing() const { return scrubbing; }
 
   // --- Get state --- //
+  /// Playback state as of its last change, published by the player and
+  /// readable from any thread without locking. While playing, media time
+  /// runs at rate from position at anchorTime.
+  struct Snapshot {
+    eState state = EMPTY;
+    MatrixClock::time_point anchorTime;
+    std::chrono::microseconds position{0};  // media time at anchorTime
+    double rate = 0;  // media time per clock time, 0 unless playing
+    std::chrono::microseconds duration{0};
+    // clock time media time 0 falls on by the frame schedule, free of the
+    // jitter of actual presentation, only meaningful while playing
+    MatrixClock::time_point origin;
+
+    /// Media time at clock time now, to the microsecond.
+    std::chrono::microseconds positionAt(MatrixClock::time_point now) const;
+  };
+  Snapshot getSnapshot() const { return snapshot.load(); }
+
   eState getState() const;
+  /// Interpolated from the snapshot, lock-free.
   std::chrono::microseconds getTime() const;
   std::chrono::microseconds getDuration() const {
-    return state == EMPTY ? std::chrono::microseconds(0)
-                          : frameTime * (intptr_t)frames.size();
+    return snapshot.load().duration;
   }
 
   size_t width() const { return width_; }
@@ -53,20 +101,56 @@ class MatrixVideoPlayer {
   void addListener(MatrixVideoPlayerListener*);
   void removeListener(MatrixVideoPlayerListener*);
 
+  /// Record frame timing into the given metrics, nullptr disables recording.
+  void setMetrics(MatrixMetrics* metrics) { this->metrics = metrics; }
+
+  /// While paused nothing is presented, apart from the paused frame once
+  /// every interval so outputs that need a steady signal keep receiving
+  /// one. Listeners are not notified of it. Zero disables the refresh, a new
+  /// interval takes effect at the next pause.
+  void setPausedRefreshInterval(std::chrono::microseconds interval) {
+    pausedRefreshInterval = interval;
+  }
+
+  /// Time source of the frame timing, only change it while stopped. A
+  /// reactor passed in from outside keeps the clock it was given.
+  void setClock(MatrixClock* clock);
+  MatrixClock* getClock() const { return clock; }
+
   // --- Input data --- //
 
   bool load(std::string filePath);
   bool load(const QImage* frames, size_t numFrames,
             std::chrono::microseconds(frameTime));
-  bool debugLoad(size_t numFrames);
-  void debugSetFrameTime(double timeSec);
+  /// Play the newest frame of source on every tick of frameTime, for as long
+  /// as it plays. The source must outlive the player or the next load. A
+  /// live source has no duration and cannot be seeked.
+  bool loadLive(MatrixFrameSource* source,
+                std::chrono::microseconds frameTime);
   void clear();
 
   // --- Present frame to daemon --- //
-  std::function<void(const QImage&)> PresentFrame;
+  // index is the frame's position in the loaded track, or the number of
+  // ticks since play for a live source
+  std::function<void(size_t index, const QImage& frame)> PresentFrame;
 
  private:
-  void displayThreadFunc();
+  // a default start anchors the timeline when the seek runs
+  void seek(std::chrono::microseconds time, MatrixClock::time_point start);
+  void sync(std::chrono::microseconds externalTime);
+  // frame timer callback, presents one frame and schedules the next
+  void presentFrame();
+  void scheduleFrame(MatrixClock::time_point deadline);
+  // called with mtx held while paused, shows frame once and parks the
+  // timeline overshoot past its start
+  void parkAt(size_t frame, std::chrono::microseconds overshoot);
+  // scrub timer callback
+  void scrubFrame();
+  void showScrubTarget();
+  // called with mtx held whenever the timeline changes
+  void publishSnapshot();
+  // refresh timer callback while paused, presents the frame to outputs only
+  void refreshFrame();
 
   void notifyListenersState(eState state);
   void notifyListenersTime(double time);
@@ -75,72 +159,55 @@ class MatrixVideoPlayer {
 
  private:
   size_t currentFrame;  // tells which frame is currently being displayed
+  size_t presentedFrame;  // the frame last handed to PresentFrame
   std::chrono::microseconds
       targetTimeDelta;  // how much time is stream off from external time source
-  std::thread displayThread;
+  std::chrono::microseconds deltaCompensation;  // shortens the next frame
+  MatrixClock::time_point frameDeadline;  // when the pending frame is due
+  MatrixClock::time_point lastTime;       // when the last frame was presented
+  MatrixClock::time_point pausedAt;
+  MatrixReactor::TimerId frameTimer;  // the refresh timer while paused
+  std::atomic<std::chrono::microseconds> pausedRefreshInterval{
+      std::chrono::microseconds(0)};
+  std::atomic<std::chrono::microseconds> scrubTarget{
+      std::chrono::microseconds(0)};
+  std::atomic_bool scrubbing{false};  // frameTimer is the scrub timer
   std::mutex mtx;
-  std::condition_variable cv;
-  std::queue<std::function<bool(std::chrono::microseconds)>> controlTaskQueue;
 
   std::atomic<eState> state;  // current state of the player
+  MatrixSeqlock<Snapshot> snapshot;
 
   std::vector<QImage> frames;  // buffer containing all the frames
+  MatrixFrameSource* liveSource = nullptr;  // plays instead of frames if set
+  MatrixFrameSource::Frame liveFrame;  // the newest frame taken from it
   std::chrono::microseconds
       frameTime;  // how much time there's between 2 frames
   size_t width_ = 0, height_ = 0;
 
   std::set<MatrixVideoPlayerListener*> listeners;
+  MatrixMetrics* metrics = nullptr;
+  MatrixClock* clock = &MatrixClock::system();
+  std::unique_ptr<MatrixReactor> ownReactor;
+  MatrixReactor* reactor;
 };
 
 template <class Rep, class Period>
 void MatrixVideoPlayer::setTime(std::chrono::duration<Rep, Period> time) {
-  if (state == PLAYING || state == PAUSED) {
-    // acquire the mutex, then put the stub into the queue
-    std::lock_guard<std::mutex> lk(mtx);
-    controlTaskQueue.push([this, time](std::chrono::microseconds frameElapsed) {
-      // compute required frame index and align playtime with next frame
-      std::chrono::microseconds timeDesired =
-          std::chrono::duration_cast<std::chrono::microseconds>(time);
-      size_t numFrames = size_t(timeDesired.count() / frameTime.count());
-      std::chrono::microseconds timeOvershoot =
-          timeDesired - numFrames * frameTime;
-
-      size_t frameDesired = numFrames;
-
-      if (frameDesired < frames.size()) {
-        std::this_thread::sleep_for(frameTime - timeOvershoot);
-        currentFrame = frameDesired;
-      }
-
-      return false;  // interrupt frame and start over
-    });
-    cv.notify_all();
-  }
+  seek(std::chrono::duration_cast<std::chrono::microseconds>(time),
+       MatrixClock::time_point());
 }
 
 template <class Rep, class Period>
 void MatrixVideoPlayer::syncToExternalSource(
     std::chrono::duration<Rep, Period> externalTime) {
-  if (state == PLAYING || state == PAUSED) {
-    // acquire the mutex, then put the stub into the queue
-    std::lock_guard<std::mutex> lk(mtx);
-    controlTaskQueue.push(
-        [this, externalTime](std::chrono::microseconds frameElapsed) {
-          // compute difference from external time
-          std::chrono::microseconds currentTime;
-          currentTime = currentFrame * frameTime + frameElapsed;
-
-          targetTimeDelta = externalTime - currentTime;
-
-          return true;  // continue frame
-        });
-    cv.notify_all();
-  }
+  sync(std::chrono::duration_cast<std::chrono::microseconds>(externalTime));
 }
 
 class MatrixVideoPlayerListener {
  public:
   virtual void onStateChanged(MatrixVideoPlayer::eState) = 0;
+  /// The time last notified before onFrameChanged() is the frame's own,
+  /// also for the first frame after a seek or while scrubbing.
   virtual void onTimeChanged(double time) = 0;
   virtual void onFrameChanged(const QImage& frame) = 0;
   virtual void onTrackEnded() = 0;
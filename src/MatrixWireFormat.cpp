@@ -0,0 +1,165 @@
+#include "MatrixWireFormat.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+int MatrixWireFormat::width() const {
+  return roomsPerRow * windowsPerRoom * horizontalPixelUnit;
+}
+
+int MatrixWireFormat::height() const { return rows * verticalPixelUnit; }
+
+int MatrixWireFormat::windowCount() const {
+  return rows * roomsPerRow * windowsPerRoom;
+}
+
+size_t MatrixWireFormat::windowSize() const {
+  size_t channels = 3 * horizontalPixelUnit * verticalPixelUnit;
+  return colorDepth <= 4 ? (channels + 1) / 2 : channels;
+}
+
+int MatrixWireFormat::packetCount() const {
+  return (windowCount() + maxWindowsPerDatagram - 1) / maxWindowsPerDatagram;
+}
+
+size_t MatrixWireFormat::datagramSize(int packetNumber) const {
+  int windows = min(maxWindowsPerDatagram,
+                    windowCount() - packetNumber * maxWindowsPerDatagram);
+  return HeaderSize + windows * windowSize();
+}
+
+size_t MatrixWireFormat::frameSize() const {
+  return packetCount() * HeaderSize + windowCount() * windowSize();
+}
+
+uint8_t MatrixWireFormat::quantize(uint8_t value) const {
+  int shift = 8 - colorDepth;
+  return uint8_t((value >> shift) << shift);
+}
+
+bool MatrixWireFormat::isValid() const {
+  return rows > 0 && roomsPerRow > 0 && windowsPerRoom > 0 &&
+         horizontalPixelUnit > 0 && verticalPixelUnit > 0 && colorDepth > 0 &&
+         colorDepth <= 8 && maxWindowsPerDatagram > 0 &&
+         packetCount() <= 256 &&
+         HeaderSize + maxWindowsPerDatagram * windowSize() <= 65507;
+}
+
+bool MatrixWireFormat::parseOption(const std::string& name,
+                                   const std::string& value) {
+  int number = atoi(value.c_str());
+  if (name == "rows") {
+    rows = number;
+  } else if (name == "rooms-per-row") {
+    roomsPerRow = number;
+  } else if (name == "windows-per-room") {
+    windowsPerRoom = number;
+  } else if (name == "horizontal-pixel-unit") {
+    horizontalPixelUnit = number;
+  } else if (name == "vertical-pixel-unit") {
+    verticalPixelUnit = number;
+  } else if (name == "color-depth") {
+    colorDepth = number;
+  } else if (name == "windows-per-datagram") {
+    maxWindowsPerDatagram = number;
+  } else if (name == "port") {
+    port = uint16_t(number);
+  } else if (name == "protocol-type") {
+    protocolType = uint8_t(number);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Encoding
+
+bool MatrixWireFormat::encode(const QImage& frame, uint8_t* output) const {
+  if (frame.width() != width() || frame.height() != height()) {
+    return false;
+  }
+  const QImage& image = frame.format() == QImage::Format_RGB888
+                            ? frame
+                            : frame.convertToFormat(QImage::Format_RGB888);
+
+  int shift = 8 - colorDepth;
+  bool isPacked = colorDepth <= 4;
+  int windowsPerRow = roomsPerRow * windowsPerRoom;
+
+  uint8_t* datagram = output;
+  for (int packet = 0; packet < packetCount(); packet++) {
+    memset(datagram, 0, datagramSize(packet));
+    datagram[0] = protocolType;
+    datagram[1] = uint8_t(packet);
+
+    int firstWindow = packet * maxWindowsPerDatagram;
+    int lastWindow = min(windowCount(), firstWindow + maxWindowsPerDatagram);
+    uint8_t* window = datagram + HeaderSize;
+    for (int w = firstWindow; w < lastWindow; w++, window += windowSize()) {
+      int x0 = (w % windowsPerRow) * horizontalPixelUnit;
+      int y0 = (w / windowsPerRow) * verticalPixelUnit;
+
+      size_t channel = 0;
+      for (int y = y0; y < y0 + verticalPixelUnit; y++) {
+        const uint8_t* line = image.constScanLine(y) + 3 * x0;
+        for (int i = 0; i < 3 * horizontalPixelUnit; i++, channel++) {
+          uint8_t value = line[i] >> shift;
+          if (!isPacked) {
+            window[channel] = value;
+          } else if (channel % 2 == 0) {
+            window[channel / 2] = uint8_t(value << 4);
+          } else {
+            window[channel / 2] |= value;
+          }
+        }
+      }
+    }
+    datagram += datagramSize(packet);
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decoding
+
+int MatrixWireFormat::decode(const uint8_t* data, size_t size,
+                             QImage& frame) const {
+  if (size < HeaderSize || data[0] != protocolType ||
+      data[1] >= packetCount() || size != datagramSize(data[1])) {
+    return -1;
+  }
+
+  int shift = 8 - colorDepth;
+  bool isPacked = colorDepth <= 4;
+  int windowsPerRow = roomsPerRow * windowsPerRoom;
+
+  int packet = data[1];
+  int firstWindow = packet * maxWindowsPerDatagram;
+  int lastWindow = min(windowCount(), firstWindow + maxWindowsPerDatagram);
+  const uint8_t* window = data + HeaderSize;
+  for (int w = firstWindow; w < lastWindow; w++, window += windowSize()) {
+    int x0 = (w % windowsPerRow) * horizontalPixelUnit;
+    int y0 = (w / windowsPerRow) * verticalPixelUnit;
+
+    size_t channel = 0;
+    for (int y = y0; y < y0 + verticalPixelUnit; y++) {
+      uint8_t* line = frame.scanLine(y) + 3 * x0;
+      for (int i = 0; i < 3 * horizontalPixelUnit; i++, channel++) {
+        uint8_t value;
+        if (!isPacked) {
+          value = window[channel];
+        } else if (channel % 2 == 0) {
+          value = window[channel / 2] >> 4;
+        } else {
+          value = window[channel / 2] & 0x0F;
+        }
+        line[i] = uint8_t(value << shift);
+      }
+    }
+  }
+  return packet;
+}
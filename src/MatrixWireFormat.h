@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QImage>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Datagram layout of the MUEB protocol, as sent by libmueb's transmitter.
+///
+/// The frame is cut into windows of horizontalPixelUnit x verticalPixelUnit
+/// pixels, numbered row by row across the building, and sent
+/// maxWindowsPerDatagram windows to a datagram. A datagram starts with the
+/// protocol type and its packet number within the frame, followed by each
+/// window's pixels row by row as R G B. With a color depth of 4 bits or less
+/// two channels share a byte, the first one in the high nibble.
+///
+/// The defaults follow libmueb's, every field must match the transmitter's
+/// configuration for the two sides to understand each other.
+struct MatrixWireFormat {
+  static const size_t HeaderSize = 2;
+
+  uint8_t protocolType = 2;
+  int rows = 13;
+  int roomsPerRow = 8;
+  int windowsPerRoom = 2;
+  int horizontalPixelUnit = 2;
+  int verticalPixelUnit = 2;
+  int colorDepth = 3;
+  int maxWindowsPerDatagram = 104;
+  uint16_t port = 10000;
+
+  int width() const;
+  int height() const;
+  int windowCount() const;
+  size_t windowSize() const;  // bytes of one window on the wire
+  int packetCount() const;    // datagrams per frame
+  size_t datagramSize(int packetNumber) const;
+  size_t frameSize() const;  // all datagrams of a frame back to back
+
+  /// The 8 bit value a channel value arrives as on the other side.
+  uint8_t quantize(uint8_t value) const;
+
+  /// Write the packetCount() datagrams of frame back to back to output,
+  /// which must have room for frameSize() bytes.
+  bool encode(const QImage& frame, uint8_t* output) const;
+
+  /// Write the windows carried by one datagram into frame, which must be an
+  /// RGB888 image of width() x height(). Returns the packet number, or -1
+  /// if the datagram does not belong to this format.
+  int decode(const uint8_t* data, size_t size, QImage& frame) const;
+
+  /// Set a field from a command line style "--name value" pair, where name
+  /// is e.g. "color-depth" or "windows-per-datagram".
+  bool parseOption(const std::string& name, const std::string& value);
+  bool isValid() const;
+};
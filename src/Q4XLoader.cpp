@@ -1,9 +1,13 @@
 #include "Q4XLoader.h"
 
-#include <QByteArray>
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <zlib.h>
+
+#include "MatrixTrace.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -15,42 +19,54 @@ Q4XLoader::Q4XLoader() {
   height_ = 0;
 }
 
-bool ReadCompressed(istream& is, vector<uint8_t>& output);
+static bool ReadCompressed(istream& is, vector<uint8_t>& output,
+                           const Q4XLoader::Progress& progress);
+static bool ReadHeader(istream& is, uint16_t& width, uint16_t& height);
+static bool ReadChunkSize(istream& is, uint32_t& size);
+static bool ParseQprHeader(const vector<uint8_t>& qpr, string& title,
+                           string& audio, string& length, size_t& index);
+static size_t ReadSoundSize(istream& is);
 
-bool Q4XLoader::load(std::string file) {
+bool Q4XLoader::load(std::string file, const Progress& progress) {
+  MATRIX_TRACE_SCOPE("load", "Q4XLoader::load");
   // open given file
   ifstream inputFile(file, ios::binary | ios::in);
   if (!inputFile.is_open()) {
     cout << "Could not open file." << endl;
     return false;
   }
-  std::vector<uint8_t> buffer(4);
-
-  // read magic header
-  if (!inputFile.read((char*)buffer.data(), 4)) {
-    return false;
-  }
-
-  auto magic = string(buffer.data(), buffer.data() + 4);
-  if (magic != "Q4X1" && magic != "Q4X2") {
-    cout << "Not Q4X." << endl;
-    return false;
-  }
-
-  // read dimensions of the video
-  buffer.resize(4);
-  if (!inputFile.read((char*)buffer.data(), 4)) {
+  uint16_t width, height;
+  if (!ReadHeader(inputFile, width, height)) {
     return false;
   }
-  uint16_t width = uint16_t(buffer[0] << 8) | buffer[1];
-  uint16_t height = uint16_t(buffer[2] << 8) | buffer[3];
   this->width_ = width;
   this->height_ = height;
 
+  // inflating takes the first half of the progress, building frames the rest
+  bool isCancelled = false;
+  auto stage = [&](float begin, float end) {
+    return [&, begin, end](float fraction) {
+      if (progress && !progress(begin + (end - begin) * fraction)) {
+        isCancelled = true;
+      }
+      return !isCancelled;
+    };
+  };
+
   // uncompress chunks
   std::vector<uint8_t> qp4, qpr, sound;
-  if (!ReadCompressed(inputFile, qp4) || !ReadCompressed(inputFile, qpr)) {
-    cout << "Uncompressing failed." << endl;
+  bool isInflated = false;
+  {
+    MATRIX_TRACE_SCOPE("load", "inflate qp4");
+    isInflated = ReadCompressed(inputFile, qp4, stage(0.0f, 0.05f));
+  }
+  if (isInflated) {
+    MATRIX_TRACE_SCOPE("load", "inflate qpr");
+    isInflated = ReadCompressed(inputFile, qpr, stage(0.05f, 0.5f));
+  }
+  if (!isInflated) {
+    cout << (isCancelled ? "Loading cancelled." : "Uncompressing failed.")
+         << endl;
     return false;
   }
 
@@ -87,42 +103,27 @@ bool Q4XLoader::load(std::string file) {
   }
 
   // parse frames from qpr
-  if (qpr.size() < 8) {
-    cout << "Invalid qpr file." << endl;
-    return false;
-  }
-  string magicHeader(qpr.data(), qpr.data() + 7);
-  if (magicHeader != "qpr v1\n") {
-    cout << "Incorrect qpr header." << endl;
-    return false;
-  }
+  MATRIX_TRACE_SCOPE("load", "parse frames");
   string title, audio, length;
-  size_t index = 7;
-  while (index < qpr.size() && qpr[index] != '\n') {
-    title += qpr[index];
-    ++index;
-  }
-  ++index;
-  while (index < qpr.size() && qpr[index] != '\n') {
-    audio += qpr[index];
-    ++index;
-  }
-  ++index;
-  while (index < qpr.size() && qpr[index] != '\n') {
-    length += qpr[index];
-    ++index;
+  size_t index;
+  if (!ParseQprHeader(qpr, title, audio, length, index)) {
+    return false;
   }
-  ++index;
 
-  QImage frame(width, height, QImage::Format_RGB888);
+  auto buildStage = stage(0.5f, 1.0f);
+  size_t numRecords = 0;
   while (index + height * width * 3 + 4 < qpr.size()) {
-    for (int x = 0; x < width; x++) {
-      for (int y = 0; y < height; y++) {
-        frame.setPixelColor(x, y,
-                            QColor(qpr[index + 3 * (x + y * width) + 0],
-                                   qpr[index + 3 * (x + y * width) + 1],
-                                   qpr[index + 3 * (x + y * width) + 2]));
-      }
+    if (numRecords++ % 64 == 0 &&
+        !buildStage(float(index) / qpr.size())) {
+      cout << "Loading cancelled." << endl;
+      originalFrames.clear();
+      return false;
+    }
+
+    // qpr frames are tightly packed RGB888 rows, copy them line by line
+    QImage frame(width, height, QImage::Format_RGB888);
+    for (int y = 0; y < height; y++) {
+      memcpy(frame.scanLine(y), &qpr[index + 3 * y * width], 3 * width);
     }
     index += height * width * 3;
     uint32_t delay = qpr[index + 0] << 24 | qpr[index + 1] << 16 |
@@ -148,33 +149,294 @@ bool Q4XLoader::load(std::string file) {
   return true;
 }
 
-bool ReadCompressed(istream& is, vector<uint8_t>& output) {
+// Follows the qpr chunk while it is inflated: the header lines first, then
+// records of frameSize pixel bytes and a 4 byte delay each. Nothing but the
+// header is kept.
+namespace {
+struct QprScanner {
+  static const size_t MaxHeaderSize = 4096;
+
+  explicit QprScanner(size_t frameSize) : frameSize(frameSize) {}
+
+  void feed(const uint8_t* data, size_t size) {
+    while (size > 0 && !isFailed) {
+      if (!isHeaderDone) {
+        header.push_back(*data++);
+        size--;
+        if (header.back() == '\n' &&
+            count(header.begin(), header.end(), '\n') == 4) {
+          isHeaderDone = true;
+          skip = frameSize;
+        } else if (header.size() > MaxHeaderSize) {
+          isFailed = true;
+        }
+        continue;
+      }
+
+      // load() only takes a record if at least one byte follows it
+      if (hasPendingDelay) {
+        hasPendingDelay = false;
+        if (pendingDelay % 20 != 0) {
+          isFailed = true;
+          return;
+        }
+        frameCount += pendingDelay / 20;
+      }
+
+      if (skip > 0) {
+        size_t count = min(skip, size);
+        skip -= count;
+        data += count;
+        size -= count;
+        continue;
+      }
+      delay = delay << 8 | *data++;
+      size--;
+      if (++delayBytes == 4) {
+        pendingDelay = delay;
+        hasPendingDelay = true;
+        delay = 0;
+        delayBytes = 0;
+        skip = frameSize;
+      }
+    }
+  }
+
+  size_t frameSize;
+  vector<uint8_t> header;
+  bool isHeaderDone = false;
+  bool isFailed = false;
+  size_t skip = 0;  // pixel bytes left of the current frame
+  uint32_t delay = 0;
+  int delayBytes = 0;
+  uint32_t pendingDelay = 0;
+  bool hasPendingDelay = false;
+  size_t frameCount = 0;
+};
+}  // namespace
+
+// Inflates a chunk of size bytes through a fixed 16 KB window, handing each
+// piece to sink, which returns false to stop. Succeeds only if the whole
+// stream inflated and sink took all of it.
+static bool InflateThrough(
+    istream& is, size_t size,
+    const function<bool(const uint8_t* data, size_t size)>& sink) {
+  static const size_t BufferSize = 16 * 1024;
+  uint8_t input[BufferSize], output[BufferSize];
+  z_stream stream = {};
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  size_t remaining = size;
+  int result = Z_OK;
+  bool isTaken = true;
+  while (result == Z_OK && isTaken) {
+    if (stream.avail_in == 0) {
+      size_t count = min(remaining, BufferSize);
+      if (count == 0 || !is.read((char*)input, count)) {
+        break;
+      }
+      remaining -= count;
+      stream.next_in = input;
+      stream.avail_in = uInt(count);
+    }
+    stream.next_out = output;
+    stream.avail_out = uInt(BufferSize);
+    result = inflate(&stream, Z_NO_FLUSH);
+    if (result == Z_OK || result == Z_STREAM_END) {
+      isTaken = sink(output, BufferSize - stream.avail_out);
+    }
+  }
+  inflateEnd(&stream);
+  return result == Z_STREAM_END && isTaken;
+}
+
+bool Q4XLoader::probe(const std::string& file, Info& info) {
+  ifstream inputFile(file, ios::binary | ios::in);
+  if (!inputFile.is_open()) {
+    return false;
+  }
+  uint16_t width, height;
+  if (!ReadHeader(inputFile, width, height)) {
+    return false;
+  }
+
+  // the qp4 chunk is not needed for playback, but load() rejects the file
+  // if it does not inflate, so it is inflated and thrown away
+  uint32_t qp4Size, qprSize;
+  if (!ReadChunkSize(inputFile, qp4Size)) {
+    return false;
+  }
+  streamoff qp4Start = inputFile.tellg();
+  if (!InflateThrough(inputFile, qp4Size,
+                      [](const uint8_t*, size_t) { return true; })) {
+    return false;
+  }
+  inputFile.clear();
+  if (!inputFile.seekg(qp4Start + streamoff(qp4Size), ios::beg) ||
+      !ReadChunkSize(inputFile, qprSize)) {
+    return false;
+  }
+  streamoff qprStart = inputFile.tellg();
+
+  QprScanner scanner(size_t(width) * height * 3);
+  if (!InflateThrough(inputFile, qprSize,
+                      [&](const uint8_t* data, size_t size) {
+                        scanner.feed(data, size);
+                        return !scanner.isFailed;
+                      })) {
+    return false;
+  }
+
+  string length;
+  size_t index;
+  if (!ParseQprHeader(scanner.header, info.title, info.audio, length,
+                      index) ||
+      scanner.frameCount == 0) {
+    return false;
+  }
+
+  inputFile.clear();
+  inputFile.seekg(qprStart + streamoff(qprSize), ios::beg);
+  size_t soundSize = ReadSoundSize(inputFile);
+
+  info.width = width;
+  info.height = height;
+  info.frameCount = scanner.frameCount;
+  info.duration = scanner.frameCount * microseconds(20 * 1000);
+  info.hasAudio = soundSize > 0;
+  return true;
+}
+
+static bool ReadChunkSize(istream& is, uint32_t& size) {
+  uint8_t buffer[4];
+  if (!is.read((char*)buffer, 4)) {
+    return false;
+  }
+  size = uint32_t(buffer[0] << 24) | uint32_t(buffer[1] << 16) |
+         uint32_t(buffer[2] << 8) | buffer[3];
+  return true;
+}
+
+static bool ReadHeader(istream& is, uint16_t& width, uint16_t& height) {
+  uint8_t buffer[4];
+
+  // read magic header
+  if (!is.read((char*)buffer, 4)) {
+    return false;
+  }
+  auto magic = string(buffer, buffer + 4);
+  if (magic != "Q4X1" && magic != "Q4X2") {
+    cout << "Not Q4X." << endl;
+    return false;
+  }
+
+  // read dimensions of the video
+  if (!is.read((char*)buffer, 4)) {
+    return false;
+  }
+  width = uint16_t(buffer[0] << 8) | buffer[1];
+  height = uint16_t(buffer[2] << 8) | buffer[3];
+  return true;
+}
+
+static bool ParseQprHeader(const vector<uint8_t>& qpr, string& title,
+                           string& audio, string& length, size_t& index) {
+  if (qpr.size() < 8) {
+    cout << "Invalid qpr file." << endl;
+    return false;
+  }
+  string magicHeader(qpr.data(), qpr.data() + 7);
+  if (magicHeader != "qpr v1\n") {
+    cout << "Incorrect qpr header." << endl;
+    return false;
+  }
+  index = 7;
+  for (string* field : {&title, &audio, &length}) {
+    field->clear();
+    while (index < qpr.size() && qpr[index] != '\n') {
+      *field += qpr[index];
+      ++index;
+    }
+    ++index;
+  }
+  return true;
+}
+
+// size of the sound file trailing the chunks, 0 if there is none
+static size_t ReadSoundSize(istream& is) {
+  size_t currentPos = is.tellg();
+  is.seekg(0, ios::end);
+  size_t fileSize = is.tellg();
+  is.seekg(currentPos, ios::beg);
+  if (fileSize - currentPos <= 4) {
+    return 0;
+  }
+
+  unsigned char cSoundFileSize[4];
+  if (!is.read(reinterpret_cast<char*>(cSoundFileSize), 4)) {
+    return 0;
+  }
+  uint32_t uSoundFileSize =
+      (uint32_t)cSoundFileSize[0] << 24 | (uint32_t)cSoundFileSize[1] << 16 |
+      (uint32_t)cSoundFileSize[2] << 8 | cSoundFileSize[3];
+  return uSoundFileSize <= fileSize - currentPos - 4 ? uSoundFileSize : 0;
+}
+
+static bool ReadCompressed(istream& is, vector<uint8_t>& output,
+                           const Q4XLoader::Progress& progress) {
   uint32_t chunkSize;
-  output.resize(4);
-  if (!is.read((char*)output.data(), 4)) {
+  if (!ReadChunkSize(is, chunkSize)) {
     return false;
   }
-  chunkSize = uint32_t(output[0] << 24) | uint32_t(output[1] << 16) |
-              uint32_t(output[2] << 8) | output[3];
   cout << "Size given in file: " << chunkSize << endl;
 
-  output.resize(chunkSize + 4);
-  if (!is.read((char*)output.data() + 4, chunkSize)) {
+  // inflate slice by slice so a load can be followed and cancelled
+  static const size_t SliceSize = 256 * 1024;
+  vector<uint8_t> input(min<size_t>(chunkSize, SliceSize));
+  size_t outputSlice = min(4 * SliceSize, max<size_t>(4 * input.size(), 4096));
+  output.clear();
+  z_stream stream = {};
+  if (inflateInit(&stream) != Z_OK) {
     return false;
   }
-  uint32_t expsize = chunkSize * 9;
-  output[0] = (expsize >> 24) & 0xFF;
-  output[1] = (expsize >> 16) & 0xFF;
-  output[2] = (expsize >> 8) & 0xFF;
-  output[3] = (expsize >> 0) & 0xFF;
+  size_t remaining = chunkSize;
+  int result = Z_OK;
+  while (result == Z_OK) {
+    if (stream.avail_in == 0) {
+      size_t count = min(remaining, input.size());
+      MATRIX_TRACE_SCOPE("load", "read");
+      if (count == 0 || !is.read((char*)input.data(), count)) {
+        break;
+      }
+      remaining -= count;
+      stream.next_in = input.data();
+      stream.avail_in = uInt(count);
+    }
+    size_t used = output.size();
+    output.resize(used + outputSlice);
+    stream.next_out = &output[used];
+    stream.avail_out = uInt(outputSlice);
+    {
+      MATRIX_TRACE_SCOPE("load", "inflate");
+      result = inflate(&stream, Z_NO_FLUSH);
+    }
+    output.resize(output.size() - stream.avail_out);
+    if (stream.avail_in == 0 && progress &&
+        !progress(1.0f - float(remaining) / chunkSize)) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
 
-  QByteArray uncompressed = qUncompress(output.data(), output.size());
-  cout << "Real size of uncompressed data: " << uncompressed.size() << endl;
-  if (uncompressed.size() == 0) {
+  if (result != Z_STREAM_END) {
+    output.clear();
+    output.shrink_to_fit();
     return false;
   }
-  output.assign(uncompressed.begin(), uncompressed.end());
-
+  // the next chunk starts after the whole chunk, padding included
+  is.seekg(remaining, ios::cur);
+  cout << "Real size of uncompressed data: " << output.size() << endl;
   return true;
 }
 
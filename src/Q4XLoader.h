@@ -2,14 +2,40 @@
 
 #include <QImage>
 #include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 class Q4XLoader {
  public:
+  /// What a q4x file contains, without its frames.
+  struct Info {
+    std::string title;
+    std::string audio;  // name of the audio track given by the author
+    size_t width = 0;
+    size_t height = 0;
+    size_t frameCount = 0;  // at the original 20 ms frame time
+    std::chrono::microseconds duration{0};
+    bool hasAudio = false;
+  };
+
+  /// Called with the fraction of the file loaded so far, returning false
+  /// cancels the load.
+  using Progress = std::function<bool(float progress)>;
+
   Q4XLoader();
 
-  bool load(std::string file);
+  /// Chunks are inflated and frames built in slices, progress is reported
+  /// and checked for cancellation after each. A cancelled load frees what it
+  /// has built and returns false.
+  bool load(std::string file, const Progress& progress = nullptr);
+
+  /// Read the metadata of file without building any frames. Both chunks
+  /// are inflated through a fixed 16 KB window, of qpr only the header and
+  /// frame delays are looked at. Fails on the same files load() would
+  /// reject, short of running out of memory.
+  static bool probe(const std::string& file, Info& info);
 
   template <class Rep, class Period>
   void resample(std::chrono::duration<Rep, Period> frameTime);
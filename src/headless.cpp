@@ -0,0 +1,608 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QMetaObject>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+
+#include "MatrixControlServer.h"
+#include "MatrixNodeSync.h"
+#include "MatrixSharedMemorySource.h"
+#endif
+
+#include "MatrixLibrary.h"
+#include "MatrixOfflineRenderer.h"
+#include "MatrixPlayer.h"
+#include "MatrixPlaylist.h"
+#include "MatrixTestPatternSource.h"
+#include "MatrixTrace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Drives a MatrixPlayer through a playlist without any widgets. Player
+// callbacks arrive on the player's worker threads, so everything that touches
+// the player is posted back to the main thread's event loop.
+class HeadlessDriver : public MatrixPlayerListener {
+ public:
+  HeadlessDriver(QCoreApplication& app, MatrixPlayer& player,
+                 MatrixPlaylist& playlist, bool loop)
+      : app(app), player(player), playlist(playlist), loop(loop) {
+    isRemoteControlled = false;
+  }
+
+  /// With a remote controller attached the daemon idles at the end of the
+  /// playlist instead of exiting.
+  void setRemoteControlled(bool remote) { isRemoteControlled = remote; }
+
+  bool start() {
+    if (!loadCurrent(playlist.size())) {
+      return false;
+    }
+    player.play();
+    return true;
+  }
+
+  void onStateChanged(MatrixPlayer::eState) override {}
+  void onTimeChanged(double time) override {}
+  void onFrameChanged(const QImage& frame) override {}
+  void onTrackEnded() override {
+    QMetaObject::invokeMethod(
+        &app, [this] { advance(); }, Qt::QueuedConnection);
+  }
+
+  /// Jump in the playlist on request of a remote controller, may be called
+  /// from any thread.
+  void seekPlaylist(intptr_t offset) {
+    QMetaObject::invokeMethod(
+        &app,
+        [this, offset] {
+          bool isPlaying = player.getState() == MatrixPlayer::PLAYING;
+          playlist.seek(offset);
+          player.clear();
+          if (loadCurrent(playlist.size()) && isPlaying) {
+            player.play();
+          }
+        },
+        Qt::QueuedConnection);
+  }
+
+ private:
+  void advance() {
+    size_t previous = playlist.currentIndex();
+    bool isBreakpointHit = playlist.seek(1);
+    bool isWrapped = playlist.currentIndex() <= previous;
+    bool isFinished = isBreakpointHit || (isWrapped && !loop);
+
+    player.clear();
+    if (isFinished && !isRemoteControlled) {
+      cout << "Playlist finished." << endl;
+      QCoreApplication::quit();
+      return;
+    }
+
+    if (loadCurrent(playlist.size())) {
+      if (!isFinished) {
+        player.play();
+      }
+    } else if (!isRemoteControlled) {
+      QCoreApplication::quit();
+    }
+  }
+
+  // load the current entry, skipping over broken files
+  bool loadCurrent(size_t attempts) {
+    for (size_t i = 0; i < attempts; i++) {
+      if (playlist[playlist.currentIndex()].isBreakpoint) {
+        playlist.seek(1);
+        continue;
+      }
+      cout << "Loading " << playlist.currentPath() << endl;
+      if (player.load(playlist.currentPath())) {
+        return true;
+      }
+      cout << "Media could not be loaded: " << playlist.currentPath() << endl;
+      playlist.seek(1);
+    }
+    cout << "No playable media in playlist." << endl;
+    return false;
+  }
+
+  QCoreApplication& app;
+  MatrixPlayer& player;
+  MatrixPlaylist& playlist;
+  bool loop;
+  bool isRemoteControlled;
+};
+
+// Render every playlist entry as fast as possible instead of playing it.
+static int renderPlaylist(const MatrixPlaylist& playlist,
+                          MatrixOfflineRenderer::eFormat format,
+                          const string& outputDir, const QImage& overlay,
+                          const MatrixFilterChain::Settings& filterSettings) {
+  // the same frames the matrix would show
+  MatrixCompositor compositor;
+  MatrixFilterChain filterChain;
+  if (!overlay.isNull()) {
+    compositor.setLayer(0, overlay);
+  }
+  filterChain.setSettings(filterSettings);
+
+  MatrixOfflineRenderer renderer;
+  renderer.setCompositor(&compositor);
+  renderer.setFilterChain(&filterChain);
+  if (format != MatrixOfflineRenderer::NONE &&
+      !QDir().mkpath(QString::fromStdString(outputDir))) {
+    cout << "Could not create " << outputDir << endl;
+    return 1;
+  }
+
+  int numFailed = 0;
+  for (size_t i = 0; i < playlist.size(); i++) {
+    if (playlist[i].isBreakpoint) {
+      continue;
+    }
+    const string& path = playlist[i].path;
+    string name = path.substr(path.find_last_of("/\\") + 1);
+    name = name.substr(0, name.find_last_of('.'));
+
+    auto start = steady_clock::now();
+    bool isRendered = renderer.render(path, outputDir + "/" + name, format);
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+    if (isRendered) {
+      cout << "OK     " << path << ": " << renderer.getFrameCount()
+           << " frames, "
+           << duration_cast<milliseconds>(renderer.getDuration()).count()
+           << " ms of media in " << elapsed.count() << " ms" << endl;
+    } else {
+      cout << "FAILED " << path << endl;
+      numFailed++;
+    }
+  }
+  return numFailed == 0 ? 0 : 2;
+}
+
+// Index the q4x files under each directory and list what was found.
+static int scanLibrary(const vector<string>& directories,
+                       const string& indexPath) {
+  MatrixLibrary library;
+  if (!indexPath.empty() && !library.loadIndex(indexPath)) {
+    return 1;
+  }
+
+  auto start = steady_clock::now();
+  size_t numProbed = 0;
+  for (const string& directory : directories) {
+    numProbed += library.scanDirectory(directory);
+  }
+  auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+
+  int numBroken = 0;
+  for (const auto& entry : library.getEntries()) {
+    if (!entry.isValid) {
+      cout << "BROKEN " << entry.path << endl;
+      numBroken++;
+      continue;
+    }
+    long long durationSec =
+        duration_cast<seconds>(entry.info.duration).count();
+    cout << "OK     " << entry.path << ": " << entry.info.title << ", "
+         << durationSec / 60 << ":" << setw(2) << setfill('0')
+         << durationSec % 60 << setfill(' ') << ", " << entry.info.width << "x"
+         << entry.info.height << ", " << entry.info.frameCount << " frames"
+         << (entry.info.hasAudio ? ", audio" : "") << endl;
+  }
+  cout << library.size() << " files, " << numProbed << " probed in "
+       << elapsed.count() << " ms" << endl;
+
+  if (!indexPath.empty() && !library.saveIndex(indexPath)) {
+    return 1;
+  }
+  return numBroken == 0 ? 0 : 2;
+}
+
+static void printUsage(const char* name) {
+  cout << "Usage: " << name << " [options] [file.q4x...]\n"
+       << "  -p, --playlist FILE  play the entries of a playlist file\n"
+       << "  -l, --loop           start over at the end of the playlist\n"
+       << "  -v, --volume N       audio volume in percent (0-100)\n"
+#ifndef _WIN32
+       << "  -c, --control PATH   accept commands on a unix domain socket\n"
+       << "  -S, --shm NAME       play the live frames another process writes\n"
+       << "                       into shared memory NAME instead of files\n"
+       << "  -n, --sync-leader PORT lead the players following on UDP PORT\n"
+       << "  -N, --sync-follow HOST[:PORT] show what the leader at HOST\n"
+       << "                       plays, frame accurate, its tracks are\n"
+       << "                       looked up by file name in the playlist\n"
+#endif
+       << "  -t, --test-pattern P play the generated test pattern P instead\n"
+       << "                       of files: gradient, chaser, pixel-id or\n"
+       << "                       white\n"
+       << "  -F, --fps N          frame rate of a live source or test pattern\n"
+       << "  -g, --geometry WxH   size of the test pattern, the matrix's by\n"
+       << "                       default\n"
+       << "  -m, --metrics FILE   write timing metrics to FILE every 10 s\n"
+       << "  -T, --trace FILE     record a Chrome trace from start to exit\n"
+       << "                       into FILE, needs a MATRIXSOURCE_TRACE build\n"
+       << "  -o, --overlay IMAGE  blend IMAGE over the show, layer 0\n"
+       << "  -D, --dimmer N       master brightness in percent (0-100)\n"
+       << "  -G, --gamma G        gamma of the LEDs' response, 1 is linear\n"
+       << "  -k, --keepalive MS   resend unchanged frames only every MS\n"
+       << "                       milliseconds, 0 sends every frame\n"
+       << "  -u, --udp HOST[:PORT] pre-encode tracks and send them to HOST\n"
+       << "                       directly instead of through libmueb, can\n"
+       << "                       be given several times to mirror the show\n"
+       << "  -r, --render FMT DIR render the playlist offline and exit, FMT\n"
+       << "                       is none (validate only), raw, png or y4m,\n"
+       << "                       with the overlay, dimmer and gamma applied\n"
+       << "  -s, --scan DIR       list the q4x files under DIR and exit, can\n"
+       << "                       be given several times\n"
+       << "  -i, --index FILE     keep the metadata of scanned files in FILE,\n"
+       << "                       later scans only read new or changed files\n"
+       << "  -R, --realtime PRIO  run the playback threads at SCHED_FIFO\n"
+       << "                       priority PRIO (1-99)\n"
+       << "  -a, --affinity CPUS  pin the playback threads to CPUS, e.g. 2,3\n"
+       << "  -L, --lock-memory    keep the process' memory from being paged\n"
+       << "                       out\n"
+       << "  -f, --prefault       touch all frame memory of a track after\n"
+       << "                       loading it\n"
+       << "  -h, --help           show this help" << endl;
+}
+
+// Route SIGINT/SIGTERM into a clean event loop exit so the player threads are
+// joined and the matrix is left in a defined state.
+static void installQuitHandler(QCoreApplication& app) {
+#ifndef _WIN32
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  thread([signals, &app] {
+    int signal = 0;
+    sigwait(&signals, &signal);
+    QMetaObject::invokeMethod(
+        &app, [] { QCoreApplication::quit(); }, Qt::QueuedConnection);
+  }).detach();
+#else
+  static QCoreApplication* quitApp = &app;
+  auto handler = [](int) {
+    QMetaObject::invokeMethod(
+        quitApp, [] { QCoreApplication::quit(); }, Qt::QueuedConnection);
+  };
+  signal(SIGINT, handler);
+  signal(SIGTERM, handler);
+#endif
+}
+
+int main(int argc, char* argv[]) {
+#ifndef _WIN32
+  // block termination signals before any thread is spawned, so only the
+  // dedicated waiter thread ever receives them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+#endif
+
+  MatrixPlaylist playlist;
+  bool loop = false;
+  int volume = -1;
+  string controlPath;
+  string liveName;
+  int syncLeaderPort = 0;
+  string syncLeader;
+  bool isTestPattern = false;
+  MatrixTestPatternSource::ePattern testPattern;
+  MatrixWireFormat patternGeometry;
+  int patternWidth = patternGeometry.width();
+  int patternHeight = patternGeometry.height();
+  double liveFps = 0;
+  string metricsPath;
+  string tracePath;
+  vector<string> udpTargets;
+  int keepaliveMs = -1;
+  string overlayPath;
+  MatrixFilterChain::Settings filterSettings;
+  string renderDir;
+  vector<string> scanDirs;
+  string indexPath;
+  MatrixRealtime::Options realtimeOptions;
+  bool isRealtimeRequested = false;
+  MatrixOfflineRenderer::eFormat renderFormat = MatrixOfflineRenderer::NONE;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      printUsage(argv[0]);
+      return 0;
+    } else if (arg == "-l" || arg == "--loop") {
+      loop = true;
+    } else if ((arg == "-p" || arg == "--playlist") && i + 1 < argc) {
+      if (!playlist.load(argv[++i])) {
+        return 1;
+      }
+    } else if ((arg == "-v" || arg == "--volume") && i + 1 < argc) {
+      volume = atoi(argv[++i]);
+    } else if ((arg == "-c" || arg == "--control") && i + 1 < argc) {
+      controlPath = argv[++i];
+    } else if ((arg == "-S" || arg == "--shm") && i + 1 < argc) {
+      liveName = argv[++i];
+    } else if ((arg == "-n" || arg == "--sync-leader") && i + 1 < argc) {
+      syncLeaderPort = atoi(argv[++i]);
+    } else if ((arg == "-N" || arg == "--sync-follow") && i + 1 < argc) {
+      syncLeader = argv[++i];
+    } else if ((arg == "-t" || arg == "--test-pattern") && i + 1 < argc) {
+      if (!MatrixTestPatternSource::parsePattern(argv[++i], testPattern)) {
+        cout << "Unknown test pattern " << argv[i] << endl;
+        return 1;
+      }
+      isTestPattern = true;
+    } else if ((arg == "-F" || arg == "--fps") && i + 1 < argc) {
+      liveFps = atof(argv[++i]);
+    } else if ((arg == "-g" || arg == "--geometry") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &patternWidth, &patternHeight) != 2 ||
+          patternWidth <= 0 || patternHeight <= 0) {
+        cout << "Invalid geometry " << argv[i] << endl;
+        return 1;
+      }
+    } else if ((arg == "-m" || arg == "--metrics") && i + 1 < argc) {
+      metricsPath = argv[++i];
+    } else if ((arg == "-T" || arg == "--trace") && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if ((arg == "-o" || arg == "--overlay") && i + 1 < argc) {
+      overlayPath = argv[++i];
+    } else if ((arg == "-D" || arg == "--dimmer") && i + 1 < argc) {
+      filterSettings.dimmer = atoi(argv[++i]) / 100.0f;
+    } else if ((arg == "-G" || arg == "--gamma") && i + 1 < argc) {
+      float gamma = float(atof(argv[++i]));
+      filterSettings.gamma[0] = filterSettings.gamma[1] =
+          filterSettings.gamma[2] = gamma;
+    } else if ((arg == "-k" || arg == "--keepalive") && i + 1 < argc) {
+      keepaliveMs = atoi(argv[++i]);
+    } else if ((arg == "-u" || arg == "--udp") && i + 1 < argc) {
+      udpTargets.push_back(argv[++i]);
+    } else if ((arg == "-r" || arg == "--render") && i + 2 < argc) {
+      if (!MatrixOfflineRenderer::parseFormat(argv[++i], renderFormat)) {
+        cout << "Unknown render format " << argv[i] << endl;
+        return 1;
+      }
+      renderDir = argv[++i];
+    } else if ((arg == "-s" || arg == "--scan") && i + 1 < argc) {
+      scanDirs.push_back(argv[++i]);
+    } else if ((arg == "-i" || arg == "--index") && i + 1 < argc) {
+      indexPath = argv[++i];
+    } else if ((arg == "-R" || arg == "--realtime") && i + 1 < argc) {
+      realtimeOptions.priority = atoi(argv[++i]);
+      isRealtimeRequested = true;
+    } else if ((arg == "-a" || arg == "--affinity") && i + 1 < argc) {
+      string cpus = argv[++i];
+      for (size_t start = 0; start < cpus.size();) {
+        size_t end = min(cpus.find(',', start), cpus.size());
+        realtimeOptions.cpus.push_back(atoi(cpus.c_str() + start));
+        start = end + 1;
+      }
+      isRealtimeRequested = true;
+    } else if (arg == "-L" || arg == "--lock-memory") {
+      realtimeOptions.isMemoryLocked = true;
+      isRealtimeRequested = true;
+    } else if (arg == "-f" || arg == "--prefault") {
+      realtimeOptions.isPrefaulting = true;
+      isRealtimeRequested = true;
+    } else if (arg[0] == '-') {
+      cout << "Unknown option " << arg << endl;
+      printUsage(argv[0]);
+      return 1;
+    } else {
+      playlist.add(arg);
+    }
+  }
+
+  if (!scanDirs.empty()) {
+    return scanLibrary(scanDirs, indexPath);
+  }
+  bool isLive = isTestPattern || !liveName.empty();
+  bool isFollower = !syncLeader.empty();
+  if (playlist.empty() && !isLive && !isFollower) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // QtCore only: no platform plugin, no widgets, no GUI thread
+  QCoreApplication app(argc, argv);
+  installQuitHandler(app);
+
+  if (!tracePath.empty()) {
+    if (!MatrixTrace::IsCompiledIn) {
+      cout << "Built without MATRIXSOURCE_TRACE, the trace stays empty"
+           << endl;
+    }
+    MatrixTrace::start();
+  }
+  auto writeTrace = [&tracePath] {
+    MatrixTrace::stop();
+    if (!tracePath.empty()) {
+      MatrixTrace::writeJson(tracePath);
+    }
+  };
+
+  QImage overlay;
+  if (!overlayPath.empty()) {
+    overlay = QImage(QString::fromStdString(overlayPath));
+    if (overlay.isNull()) {
+      cout << "Could not load overlay " << overlayPath << endl;
+      return 1;
+    }
+  }
+
+  // offline rendering never touches the player or the audio system
+  if (!renderDir.empty()) {
+    int result = renderPlaylist(playlist, renderFormat, renderDir, overlay,
+                                filterSettings);
+    writeTrace();
+    return result;
+  }
+
+  MatrixPlayer player;
+  if (!udpTargets.empty()) {
+    player.clearOutputs();
+  }
+  for (string target : udpTargets) {
+    MatrixWireFormat format;
+    size_t colon = target.find(':');
+    if (colon != string::npos) {
+      format.port = uint16_t(atoi(target.c_str() + colon + 1));
+      target.resize(colon);
+    }
+    auto output = make_unique<MatrixUdpOutput>(format);
+    if (!output->open(target)) {
+      return 1;
+    }
+    player.addOutput(std::move(output));
+  }
+  if (!overlay.isNull()) {
+    player.getCompositor().setLayer(0, overlay);
+  }
+  player.getFilterChain().setSettings(filterSettings);
+  if (keepaliveMs >= 0) {
+    player.setKeepaliveInterval(milliseconds(keepaliveMs));
+  }
+  if (volume >= 0) {
+    player.setVolume(volume / 100.0f);
+  }
+  // without the privileges the show still goes on, just at normal priority
+  if (isRealtimeRequested) {
+    player.setRealtimeOptions(realtimeOptions);
+  }
+
+  // a follower plays whatever the leader does, never the playlist by itself
+  HeadlessDriver driver(app, player, playlist, loop);
+  if (!isFollower) {
+    player.addListener(&driver);
+  }
+
+#ifndef _WIN32
+  MatrixControlServer controlServer(player);
+  if (!controlPath.empty()) {
+    if (!controlServer.start(controlPath)) {
+      player.removeListener(&driver);
+      return 1;
+    }
+    if (!isLive) {
+      controlServer.SeekPlaylist = [&driver](intptr_t offset) {
+        driver.seekPlaylist(offset);
+      };
+    }
+    driver.setRemoteControlled(true);
+  }
+
+#endif
+
+  // a live source never ends, the playlist is not played at all
+  auto liveFrameTime = liveFps > 0 ? microseconds(lround(1e6 / liveFps))
+                                   : MatrixPlayer::FrameTime;
+  auto loadLive = [&]() {
+    unique_ptr<MatrixFrameSource> liveSource;
+    if (isTestPattern) {
+      liveSource = make_unique<MatrixTestPatternSource>(
+          testPattern, patternWidth, patternHeight);
+    }
+#ifndef _WIN32
+    if (!liveName.empty()) {
+      auto source = make_unique<MatrixSharedMemorySource>();
+      if (!source->open(liveName)) {
+        return false;
+      }
+      liveSource = std::move(source);
+    }
+#endif
+    return liveSource &&
+           player.loadLive(std::move(liveSource), liveFrameTime);
+  };
+
+#ifndef _WIN32
+  MatrixNodeSync nodeSync(player);
+  if (isFollower) {
+    // the leader names tracks by file name, live sources as "live"
+    nodeSync.LoadTrack = [&](const string& name) {
+      if (name == "live") {
+        return isLive && loadLive();
+      }
+      for (size_t i = 0; i < playlist.size(); i++) {
+        const string& path = playlist[i].path;
+        if (!playlist[i].isBreakpoint &&
+            path.substr(path.find_last_of("/\\") + 1) == name) {
+          return player.load(path);
+        }
+      }
+      cout << "Track " << name << " of the leader is not in the playlist"
+           << endl;
+      return false;
+    };
+    string host = syncLeader;
+    uint16_t port = MatrixNodeSync::DefaultPort;
+    size_t colon = host.find(':');
+    if (colon != string::npos) {
+      port = uint16_t(atoi(host.c_str() + colon + 1));
+      host.resize(colon);
+    }
+    if (!nodeSync.startFollower(host, port)) {
+      return 1;
+    }
+  }
+#endif
+
+  if (isFollower) {
+    // nothing plays until the leader says what
+  } else if (isLive) {
+    if (!loadLive()) {
+      player.removeListener(&driver);
+      return 1;
+    }
+    player.play();
+  } else if (!driver.start()) {
+    player.removeListener(&driver);
+    return 1;
+  }
+
+#ifndef _WIN32
+  if (syncLeaderPort > 0 && !nodeSync.startLeader(uint16_t(syncLeaderPort))) {
+    player.removeListener(&driver);
+    return 1;
+  }
+#endif
+
+  QTimer metricsTimer;
+  if (!metricsPath.empty()) {
+    QObject::connect(&metricsTimer, &QTimer::timeout, [&player, &metricsPath] {
+      if (!player.getMetrics().writeSnapshot(metricsPath)) {
+        cout << "Could not write metrics to " << metricsPath << endl;
+      }
+    });
+    metricsTimer.start(10000);
+  }
+
+  int result = app.exec();
+
+#ifndef _WIN32
+  nodeSync.stop();
+  controlServer.stop();
+#endif
+  player.removeListener(&driver);
+  player.clear();
+  writeTrace();
+  return result;
+}
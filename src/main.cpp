@@ -5,6 +5,7 @@
 #include <thread>
 
 #include "MatrixPlayerWindow.h"
+#include "MatrixTestPatternSource.h"
 #include "MatrixVideoPlayer.h"
 #include "Q4XLoader.h"
 
@@ -12,9 +13,9 @@ using namespace std;
 using namespace std::chrono;
 
 int test() {
+  MatrixTestPatternSource pattern(MatrixTestPatternSource::CHASER, 24, 36);
   MatrixVideoPlayer player;
-  player.debugLoad(1000);  // 33ms*1000 = 33s
-  player.debugSetFrameTime(0.050);
+  player.loadLive(&pattern, milliseconds(50));
   player.play();
 
   this_thread::sleep_for(milliseconds(1000));
@@ -0,0 +1,157 @@
+// Latency benchmark for the headless player's control socket.
+//
+// Connects to a running matrixsource-headless (started with --control), then
+// repeatedly seeks between two positions and toggles pause, measuring the
+// time from sending a command until the first presented frame (or state
+// notification) that reflects it.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+class ControlConnection {
+ public:
+  ~ControlConnection() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  bool connect(const string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    return fd >= 0 &&
+           ::connect(fd, (sockaddr*)&address, sizeof(address)) == 0;
+  }
+
+  bool send(const string& command) {
+    string line = command + "\n";
+    return ::send(fd, line.data(), line.size(), MSG_NOSIGNAL) ==
+           (ssize_t)line.size();
+  }
+
+  // blocking read of the next line, empty on disconnect
+  string readLine() {
+    size_t lineEnd;
+    while ((lineEnd = buffer.find('\n')) == string::npos) {
+      char chunk[4096];
+      ssize_t received = read(fd, chunk, sizeof(chunk));
+      if (received <= 0) {
+        return "";
+      }
+      buffer.append(chunk, received);
+    }
+    string line = buffer.substr(0, lineEnd);
+    buffer.erase(0, lineEnd + 1);
+    return line;
+  }
+
+ private:
+  int fd = -1;
+  string buffer;
+};
+
+static void report(const string& name, vector<double> samples) {
+  if (samples.empty()) {
+    cout << name << ": no samples" << endl;
+    return;
+  }
+  sort(samples.begin(), samples.end());
+  auto percentile = [&](double p) {
+    return samples[min(samples.size() - 1, size_t(p * samples.size()))];
+  };
+  cout << name << " (" << samples.size() << " samples, us): min "
+       << samples.front() << "  p50 " << percentile(0.5) << "  p99 "
+       << percentile(0.99) << "  max " << samples.back() << endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    cout << "Usage: " << argv[0] << " SOCKET [iterations] [seekA_ms seekB_ms]"
+         << endl;
+    return 1;
+  }
+  int iterations = argc > 2 ? atoi(argv[2]) : 50;
+  long long seekTargets[2] = {argc > 3 ? atoll(argv[3]) : 1000,
+                              argc > 4 ? atoll(argv[4]) : 5000};
+
+  ControlConnection connection;
+  if (!connection.connect(argv[1])) {
+    cout << "Could not connect to " << argv[1] << endl;
+    return 1;
+  }
+
+  vector<double> roundTrip, seekToFrame, pauseToState, playToState;
+
+  // waits until a line satisfying the predicate arrives, returns the elapsed
+  // time since start in microseconds or -1 on disconnect
+  auto waitFor = [&](steady_clock::time_point start, auto predicate) {
+    string line;
+    while (!(line = connection.readLine()).empty()) {
+      if (predicate(line)) {
+        return duration<double, micro>(steady_clock::now() - start).count();
+      }
+    }
+    return -1.0;
+  };
+
+  connection.send("subscribe frames");
+  connection.send("play");
+
+  for (int i = 0; i < iterations; i++) {
+    auto start = steady_clock::now();
+    connection.send("ping");
+    roundTrip.push_back(
+        waitFor(start, [](const string& line) { return line == "pong"; }));
+
+    // the frame containing the target proves the seek took effect, it
+    // starts up to a frame period (33 ms at 30 fps) before it
+    long long target = seekTargets[i % 2];
+    start = steady_clock::now();
+    connection.send("seek " + to_string(target));
+    seekToFrame.push_back(waitFor(start, [target](const string& line) {
+      if (line.compare(0, 6, "frame ") != 0) {
+        return false;
+      }
+      long long time = atoll(line.c_str() + 6);
+      return time > target - 40 && time < target + 100;
+    }));
+
+    start = steady_clock::now();
+    connection.send("pause");
+    pauseToState.push_back(waitFor(
+        start, [](const string& line) { return line == "state PAUSED"; }));
+
+    start = steady_clock::now();
+    connection.send("play");
+    playToState.push_back(waitFor(
+        start, [](const string& line) { return line == "state PLAYING"; }));
+
+    if (roundTrip.back() < 0 || seekToFrame.back() < 0 ||
+        pauseToState.back() < 0 || playToState.back() < 0) {
+      cout << "Connection lost." << endl;
+      return 1;
+    }
+  }
+  connection.send("unsubscribe frames");
+
+  report("ping round trip", roundTrip);
+  report("seek to frame", seekToFrame);
+  report("pause to state", pauseToState);
+  report("play to state", playToState);
+  return 0;
+}
@@ -0,0 +1,244 @@
+// End-to-end benchmark of the MUEB transmitter against a loopback receiver.
+//
+// Plays a synthetic track through MatrixVideoPlayer and the real
+// libmueb::MuebTransmitter, with a MatrixMuebReceiver standing in for the
+// building on the same machine. Every received frame is identified, checked
+// pixel by pixel against what the wire format should have preserved, and
+// timestamped against the moment the player presented it and against the
+// ideal timeline.
+//
+// The transmitter has to be configured to send to 127.0.0.1 and to the same
+// geometry, color depth and port as given here. With --pre-encoded the track
+// is encoded up front and sent through MatrixUdpSender instead, the path
+// MatrixPlayer takes with pre-encoding enabled.
+
+#include <QImage>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixMetrics.h"
+#include "MatrixMuebReceiver.h"
+#include "MatrixUdpSender.h"
+#include "MatrixVideoPlayer.h"
+#include "MatrixWireFormat.h"
+#include "muebtransmitter.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// the frame index is written into the first pixels, one bit per channel, so
+// it survives any color depth
+static const int IndexBits = 24;
+
+static QImage makeFrame(const MatrixWireFormat& format, uint32_t index) {
+  QImage frame(format.width(), format.height(), QImage::Format_RGB888);
+  uint32_t seed = index * 2654435761u + 1;
+  for (int y = 0; y < frame.height(); y++) {
+    uint8_t* line = frame.scanLine(y);
+    for (int i = 0; i < 3 * frame.width(); i++) {
+      seed = seed * 1664525u + 1013904223u;
+      line[i] = uint8_t(seed >> 24);
+    }
+  }
+  uint8_t* marker = frame.scanLine(0);
+  for (int bit = 0; bit < IndexBits; bit++) {
+    marker[bit] = (index >> bit) & 1 ? 0xFF : 0x00;
+  }
+  return frame;
+}
+
+static uint32_t frameIndex(const QImage& frame) {
+  const uint8_t* marker = frame.constScanLine(0);
+  uint32_t index = 0;
+  for (int bit = 0; bit < IndexBits; bit++) {
+    if (marker[bit] & 0x80) {
+      index |= 1u << bit;
+    }
+  }
+  return index;
+}
+
+static size_t countPixelErrors(const MatrixWireFormat& format,
+                               const QImage& expected,
+                               const QImage& received) {
+  size_t errors = 0;
+  for (int y = 0; y < expected.height(); y++) {
+    const uint8_t* a = expected.constScanLine(y);
+    const uint8_t* b = received.constScanLine(y);
+    for (int x = 0; x < expected.width(); x++) {
+      for (int c = 0; c < 3; c++) {
+        if (format.quantize(a[3 * x + c]) != b[3 * x + c]) {
+          errors++;
+          break;
+        }
+      }
+    }
+  }
+  return errors;
+}
+
+static void printHistogram(const string& name, const MatrixHistogram& h) {
+  auto s = h.snapshot();
+  cout << name << " (us): p50 " << s.p50 << "  p99 " << s.p99 << "  max "
+       << s.max << endl;
+}
+
+int main(int argc, char* argv[]) {
+  MatrixWireFormat format;
+  seconds length(5);
+  int fps = 30;
+  bool isPreEncoded = false;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) {
+      length = seconds(atoi(argv[++i]));
+    } else if (arg == "--fps" && i + 1 < argc) {
+      fps = atoi(argv[++i]);
+    } else if (arg == "--pre-encoded") {
+      isPreEncoded = true;
+    } else if (arg.compare(0, 2, "--") == 0 && i + 1 < argc &&
+               format.parseOption(arg.substr(2), argv[i + 1])) {
+      i++;
+    } else {
+      cout << "Usage: " << argv[0]
+           << " [--seconds N] [--fps N] [--pre-encoded] [--port N]"
+              " [--color-depth N] [--windows-per-datagram N] [--rows N]"
+              " [--rooms-per-row N] [--windows-per-room N]"
+              " [--horizontal-pixel-unit N] [--vertical-pixel-unit N]"
+              " [--protocol-type N]"
+           << endl;
+      return 1;
+    }
+  }
+  if (!format.isValid() || fps <= 0) {
+    cout << "Invalid configuration." << endl;
+    return 1;
+  }
+
+  libmueb::MuebTransmitter& transmitter = libmueb::MuebTransmitter::Instance();
+  if (!isPreEncoded && (transmitter.width() != format.width() ||
+                        transmitter.height() != format.height())) {
+    cout << "Transmitter is configured for " << transmitter.width() << "x"
+         << transmitter.height() << ", the receiver for " << format.width()
+         << "x" << format.height() << endl;
+    return 1;
+  }
+
+  microseconds frameTime(1000000 / fps);
+  size_t numFrames = length / frameTime + 1;
+  vector<QImage> frames;
+  for (size_t i = 0; i < numFrames; i++) {
+    frames.push_back(makeFrame(format, uint32_t(i)));
+  }
+
+  // presentation instants, written by the reactor
+  vector<atomic<int64_t>> presented(numFrames);
+  for (auto& time : presented) {
+    time = -1;
+  }
+  auto epoch = MatrixClock::system().now();
+  auto sinceEpoch = [&](MatrixClock::time_point time) {
+    return duration_cast<microseconds>(time - epoch).count();
+  };
+
+  MatrixHistogram sendLatency;     // presentation to last datagram received
+  MatrixHistogram scheduleOffset;  // arrival minus the ideal timeline
+  atomic<size_t> receivedFrames(0), corruptFrames(0), pixelErrors(0);
+  atomic<size_t> unknownFrames(0);
+  atomic<int64_t> firstPresented(-1);
+
+  MatrixMuebReceiver receiver(format);
+  receiver.FrameReceived = [&](const QImage& frame,
+                               MatrixClock::time_point arrival) {
+    uint32_t index = frameIndex(frame);
+    if (index >= numFrames || presented[index] < 0) {
+      unknownFrames++;
+      return;
+    }
+    receivedFrames++;
+    int64_t arrivalUs = sinceEpoch(arrival);
+    sendLatency.record(arrivalUs - presented[index]);
+    scheduleOffset.record(arrivalUs - firstPresented -
+                          (frameTime * (intptr_t)index).count());
+
+    size_t errors = countPixelErrors(format, frames[index], frame);
+    if (errors > 0) {
+      corruptFrames++;
+      pixelErrors += errors;
+    }
+  };
+  if (!receiver.start()) {
+    return 1;
+  }
+
+  MatrixUdpSender sender(format);
+  vector<uint8_t> encoded;
+  if (isPreEncoded) {
+    encoded.resize(numFrames * format.frameSize());
+    for (size_t i = 0; i < numFrames; i++) {
+      format.encode(frames[i], &encoded[i * format.frameSize()]);
+    }
+    if (!sender.open("127.0.0.1")) {
+      return 1;
+    }
+  }
+
+  MatrixVideoPlayer player;
+  player.load(frames.data(), frames.size(), frameTime);
+  player.PresentFrame = [&](size_t index, const QImage& frame) {
+    if (presented[index] < 0) {
+      int64_t now = sinceEpoch(MatrixClock::system().now());
+      if (index == 0) {
+        firstPresented = now;
+      }
+      presented[index] = now;
+    }
+    if (isPreEncoded) {
+      sender.sendFrame(&encoded[index * format.frameSize()]);
+    } else {
+      transmitter.SendFrame(frame);
+    }
+  };
+
+  auto start = MatrixClock::system().now();
+  player.play();
+  while (player.getState() == MatrixVideoPlayer::PLAYING) {
+    this_thread::sleep_for(milliseconds(50));
+  }
+  player.stop();
+  double elapsed =
+      duration<double>(MatrixClock::system().now() - start).count();
+
+  // let the last datagrams drain
+  this_thread::sleep_for(milliseconds(200));
+  receiver.stop();
+
+  auto stats = receiver.getStats();
+  size_t sentFrames = 0;
+  for (auto& time : presented) {
+    sentFrames += time >= 0;
+  }
+
+  cout << "Frames: " << sentFrames << " presented, " << receivedFrames
+       << " received, " << stats.incompleteFrames << " incomplete, "
+       << unknownFrames << " unidentified" << endl;
+  cout << "Datagrams: " << stats.datagrams << " received, "
+       << stats.lostPackets << " lost, " << stats.malformed << " malformed"
+       << endl;
+  cout << "Throughput: " << receivedFrames / elapsed << " frames/s, "
+       << stats.bytes / elapsed / 1024 << " KiB/s" << endl;
+  cout << "Pixel errors: " << pixelErrors << " in " << corruptFrames
+       << " frames" << endl;
+  printHistogram("Send latency", sendLatency);
+  printHistogram("Arrival vs. timeline", scheduleOffset);
+
+  bool isClean = receivedFrames == sentFrames && pixelErrors == 0 &&
+                 stats.malformed == 0;
+  return isClean ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+// Frame pacing regression harness for MatrixVideoPlayer.
+//
+// Plays a synthetic track through the real frame timer into a recording
+// PresentFrame sink at 30 and 50 fps, on an idle system and under synthetic
+// CPU load, and reports the inter-frame error and cumulative drift. A second
+// pass runs on a simulated clock against a simulated audio clock with a
+// forced offset and reports how quickly the synchronizer pulls it in.
+//
+// With --max-p99 US the exit code is non-zero when any real time run has a
+// p99 inter-frame error above US microseconds.
+
+#include <QImage>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixVideoPlayer.h"
+
+using namespace std;
+using namespace std::chrono;
+
+struct Presentation {
+  MatrixClock::time_point time;
+  size_t frame;
+};
+
+struct SyntheticTrack {
+  vector<QImage> frames;
+
+  SyntheticTrack(size_t numFrames) {
+    for (size_t i = 0; i < numFrames; i++) {
+      QImage frame(32, 26, QImage::Format_RGB888);
+      frame.fill(QColor(i & 0xFF, (i >> 8) & 0xFF, 0));
+      frames.push_back(frame);
+    }
+  }
+};
+
+static vector<Presentation> play(
+    MatrixClock& clock, const SyntheticTrack& track, microseconds frameTime,
+    const function<void(MatrixVideoPlayer&)>& run) {
+  vector<Presentation> presentations(track.frames.size() + 16);
+  atomic<size_t> count(0);
+
+  MatrixVideoPlayer player;
+  player.setClock(&clock);
+  player.load(track.frames.data(), track.frames.size(), frameTime);
+  player.PresentFrame = [&](size_t index, const QImage& frame) {
+    size_t i = count++;
+    if (i < presentations.size()) {
+      presentations[i] = {clock.now(), index};
+    }
+  };
+
+  player.play();
+  run(player);
+
+  // the reactor must be able to reach its next deadline on its own
+  if (auto simulated = dynamic_cast<MatrixSimulatedClock*>(&clock)) {
+    simulated->setAutoAdvance(1);
+  }
+  player.stop();
+
+  presentations.resize(min(count.load(), presentations.size()));
+  return presentations;
+}
+
+static double percentile(vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  sort(values.begin(), values.end());
+  return values[min(values.size() - 1, size_t(p * values.size()))];
+}
+
+// returns the p99 inter-frame error in microseconds
+static double reportPacing(const string& name,
+                           const vector<Presentation>& presentations,
+                           microseconds frameTime) {
+  vector<double> errors;
+  for (size_t i = 1; i < presentations.size(); i++) {
+    auto interval = presentations[i].time - presentations[i - 1].time;
+    errors.push_back(
+        fabs(duration<double, micro>(interval - frameTime).count()));
+  }
+  if (errors.empty()) {
+    cout << name << ": no frames presented" << endl;
+    return 0;
+  }
+
+  auto span = presentations.back().time - presentations.front().time;
+  auto expected = frameTime * (intptr_t)(presentations.size() - 1);
+  double drift = duration<double, micro>(span - expected).count();
+  double p99 = percentile(errors, 0.99);
+
+  cout << name << ": " << presentations.size()
+       << " frames, inter-frame error (us) p50 " << percentile(errors, 0.5)
+       << "  p99 " << p99 << "  max "
+       << *max_element(errors.begin(), errors.end()) << ", drift " << drift
+       << " us" << endl;
+  return p99;
+}
+
+static vector<thread> startStress(atomic_bool& run) {
+  vector<thread> threads;
+  unsigned numThreads = max(2u, thread::hardware_concurrency());
+  for (unsigned i = 0; i < numThreads; i++) {
+    threads.emplace_back([&run] {
+      volatile double sink = 1.0;
+      while (run) {
+        for (int j = 0; j < 10000; j++) {
+          sink = sqrt(sink + j);
+        }
+      }
+    });
+  }
+  return threads;
+}
+
+// Audio runs ahead of the video by offset, the synchronizer is fed once per
+// second like MatrixPlayer does. Everything happens on a simulated clock.
+static void reportConvergence(microseconds frameTime, milliseconds offset,
+                              seconds length) {
+  MatrixSimulatedClock clock;
+  clock.setAutoAdvance(2);  // the reactor and the feeding thread below
+
+  // the video catches up with the audio, it must not run out of frames early
+  auto margin = 2 * duration_cast<microseconds>(offset < offset.zero()
+                                                    ? -offset
+                                                    : offset);
+  SyntheticTrack track((length + margin) / frameTime + 2);
+  MatrixClock::time_point start;
+
+  auto presentations =
+      play(clock, track, frameTime, [&](MatrixVideoPlayer& player) {
+        start = clock.now();
+        for (seconds t(1); t < length; t += seconds(1)) {
+          clock.sleepUntil(start + t);
+          player.syncToExternalSource(duration_cast<microseconds>(
+              clock.now() - start + offset));
+        }
+      });
+
+  // Offset between where the audio is and where the player thinks it is.
+  // A frame is sent once its display interval has elapsed, so frame i goes
+  // out at the player's media time (i + 1) * frameTime.
+  double settledAt = -1;
+  double residual = 0;
+  for (auto& presentation : presentations) {
+    if (presentation.time >= start + length - seconds(1)) {
+      break;  // feeding has ended
+    }
+    auto audioTime = presentation.time - start + offset;
+    auto videoTime = frameTime * (intptr_t)(presentation.frame + 1);
+    residual = duration<double, milli>(audioTime - videoTime).count();
+    double at = duration<double>(presentation.time - start).count();
+    if (fabs(residual) > frameTime.count() / 1000.0) {
+      settledAt = -1;
+    } else if (settledAt < 0) {
+      settledAt = at;
+    }
+  }
+
+  cout << "sync " << 1000000 / frameTime.count() << " fps, offset "
+       << offset.count() << " ms: ";
+  if (settledAt < 0) {
+    cout << "did not converge within " << length.count() << " s";
+  } else {
+    cout << "within one frame after " << settledAt << " s";
+  }
+  cout << ", final residual " << residual << " ms" << endl;
+}
+
+int main(int argc, char* argv[]) {
+  seconds length(5);
+  double maxP99 = -1;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) {
+      length = seconds(atoi(argv[++i]));
+    } else if (arg == "--max-p99" && i + 1 < argc) {
+      maxP99 = atof(argv[++i]);
+    } else {
+      cout << "Usage: " << argv[0] << " [--seconds N] [--max-p99 US]"
+           << endl;
+      return 1;
+    }
+  }
+
+  bool isRegressed = false;
+  for (int fps : {30, 50}) {
+    microseconds frameTime(1000000 / fps);
+    SyntheticTrack track(length / frameTime + 2);
+
+    for (bool isStressed : {false, true}) {
+      atomic_bool runStress(isStressed);
+      vector<thread> stress;
+      if (isStressed) {
+        stress = startStress(runStress);
+      }
+
+      auto presentations = play(MatrixClock::system(), track, frameTime,
+                                [&](MatrixVideoPlayer& player) {
+                                  this_thread::sleep_for(length);
+                                });
+
+      runStress = false;
+      for (auto& thread : stress) {
+        thread.join();
+      }
+
+      string name =
+          to_string(fps) + " fps " + (isStressed ? "stress" : "idle");
+      double p99 = reportPacing(name, presentations, frameTime);
+      if (maxP99 >= 0 && p99 > maxP99) {
+        isRegressed = true;
+      }
+    }
+  }
+
+  for (int fps : {30, 50}) {
+    for (int offset : {-500, 200, 1500}) {
+      reportConvergence(microseconds(1000000 / fps), milliseconds(offset),
+                        seconds(30));
+    }
+  }
+
+  return isRegressed ? 1 : 0;
+}
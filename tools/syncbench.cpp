@@ -0,0 +1,214 @@
+// Frame alignment benchmark of MatrixNodeSync across processes on loopback.
+//
+// Forks one leader and several followers, each a full MatrixPlayer playing
+// a live test pattern without outputs. Every follower reads its time from a
+// clock shifted by a different random offset of up to a second, as if it
+// ran on a machine of its own, and has to find the leader's timeline over
+// the sync protocol. Each process timestamps every frame it presents on the
+// real steady clock, which all processes share, and the spread of the
+// instants the same frame was presented at is reported. Halfway through the
+// leader pauses for a moment, so the followers have to follow a change too.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixClock.h"
+#include "MatrixNodeSync.h"
+#include "MatrixPlayer.h"
+#include "MatrixTestPatternSource.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// the system clock seen from another machine
+class ShiftedClock : public MatrixClock {
+ public:
+  ShiftedClock(duration shift) : shift(shift) {}
+
+  time_point now() const override { return system().now() + shift; }
+  void sleepUntil(time_point deadline) override {
+    system().sleepUntil(deadline - shift);
+  }
+  bool waitUntil(std::condition_variable& cv,
+                 std::unique_lock<std::mutex>& lock, time_point deadline,
+                 const std::function<bool()>& pred) override {
+    if (deadline == time_point::max()) {
+      return system().waitUntil(cv, lock, deadline, pred);
+    }
+    return system().waitUntil(cv, lock, deadline - shift, pred);
+  }
+
+ private:
+  duration shift;
+};
+
+// records when each frame of the timeline was presented
+class FrameRecorder : public MatrixPlayerListener {
+ public:
+  void onStateChanged(MatrixPlayer::eState) override {}
+  void onTimeChanged(double time) override {
+    // the time of the frame just presented plus one frame
+    int64_t index = llround(time * 1e6 / MatrixPlayer::FrameTime.count());
+    int64_t now = duration_cast<nanoseconds>(
+                      steady_clock::now().time_since_epoch())
+                      .count();
+    presented.push_back({index, now});
+  }
+  void onFrameChanged(const QImage&) override {}
+  void onTrackEnded() override {}
+
+  vector<pair<int64_t, int64_t>> presented;
+};
+
+static unique_ptr<MatrixFrameSource> makeSource() {
+  return make_unique<MatrixTestPatternSource>(MatrixTestPatternSource::CHASER,
+                                              32, 26);
+}
+
+static void runNode(bool isLeader, milliseconds shift, uint16_t port,
+                    seconds length, int outputFd) {
+  ShiftedClock localClock(shift);
+  MatrixPlayer player;
+  player.clearOutputs();
+  FrameRecorder recorder;
+  player.addListener(&recorder);
+
+  MatrixNodeSync sync(player, localClock);
+  if (isLeader) {
+    player.setClock(&localClock);
+    if (!sync.startLeader(port, "127.0.0.1")) {
+      _exit(1);
+    }
+    player.loadLive(makeSource());
+    player.play();
+    this_thread::sleep_for(length / 2);
+    player.pause();
+    this_thread::sleep_for(milliseconds(700));
+    player.play();
+    this_thread::sleep_for(length / 2);
+  } else {
+    sync.LoadTrack = [&player](const string& name) {
+      return name == "live" && player.loadLive(makeSource());
+    };
+    if (!sync.startFollower("127.0.0.1", port)) {
+      _exit(1);
+    }
+    this_thread::sleep_for(length + milliseconds(700));
+    auto stats = sync.getStats();
+    cout << "follower shifted " << shift.count() << " ms: offset "
+         << duration<double, milli>(stats.offset).count() << " ms, delay "
+         << duration_cast<microseconds>(stats.delay).count() << " us, "
+         << stats.samples << " samples, " << stats.alignments
+         << " alignments" << endl;
+  }
+  player.removeListener(&recorder);
+  sync.stop();
+  player.clear();
+
+  for (auto& frame : recorder.presented) {
+    int64_t values[2] = {frame.first, frame.second};
+    if (write(outputFd, values, sizeof(values)) != sizeof(values)) {
+      _exit(1);
+    }
+  }
+  close(outputFd);
+  _exit(0);
+}
+
+int main(int argc, char* argv[]) {
+  int followers = 3;
+  seconds length(10);
+  uint16_t port = MatrixNodeSync::DefaultPort;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--followers" && i + 1 < argc) {
+      followers = atoi(argv[++i]);
+    } else if (arg == "--length" && i + 1 < argc) {
+      length = seconds(atoi(argv[++i]));
+    } else if (arg == "--port" && i + 1 < argc) {
+      port = uint16_t(atoi(argv[++i]));
+    } else {
+      cout << "Usage: " << argv[0]
+           << " [--followers N] [--length SECONDS] [--port PORT]" << endl;
+      return 1;
+    }
+  }
+
+  mt19937 random(random_device{}());
+  uniform_int_distribution<int> shifts(-1000, 1000);
+  vector<pid_t> children;
+  vector<int> pipes;
+  for (int node = 0; node <= followers; node++) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+      return 1;
+    }
+    milliseconds shift(node == 0 ? 0 : shifts(random));
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      runNode(node == 0, shift, port, length, fds[1]);
+    }
+    close(fds[1]);
+    children.push_back(pid);
+    pipes.push_back(fds[0]);
+  }
+
+  // frame index -> when each node presented it
+  map<int64_t, vector<int64_t>> frames;
+  for (int fd : pipes) {
+    int64_t values[2];
+    while (read(fd, values, sizeof(values)) == sizeof(values)) {
+      frames[values[0]].push_back(values[1]);
+    }
+    close(fd);
+  }
+  bool isClean = true;
+  for (pid_t pid : children) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    isClean = isClean && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  // frames every node presented, the first second is spent finding the
+  // leader
+  vector<double> spreads;
+  int64_t skipped = seconds(1) / MatrixPlayer::FrameTime;
+  int64_t firstFrame = frames.empty() ? 0 : frames.begin()->first + skipped;
+  for (auto& frame : frames) {
+    bool isOnAll = int(frame.second.size()) == followers + 1;
+    if (frame.first < firstFrame || !isOnAll) {
+      continue;
+    }
+    auto range = minmax_element(frame.second.begin(), frame.second.end());
+    spreads.push_back((*range.second - *range.first) / 1000.0);
+  }
+  if (spreads.empty()) {
+    cout << "No frame was presented by every node" << endl;
+    return 1;
+  }
+
+  sort(spreads.begin(), spreads.end());
+  auto percentile = [&](double p) {
+    return spreads[min(spreads.size() - 1, size_t(p * spreads.size()))];
+  };
+  size_t withinMs = upper_bound(spreads.begin(), spreads.end(), 1000.0) -
+                    spreads.begin();
+  cout << spreads.size() << " frames on all " << followers + 1
+       << " nodes, spread (us) p50 " << percentile(0.5) << "  p99 "
+       << percentile(0.99) << "  max " << spreads.back() << ", "
+       << 100.0 * withinMs / spreads.size() << "% within 1 ms" << endl;
+  return isClean && withinMs == spreads.size() ? 0 : 2;
+}